@@ -0,0 +1,195 @@
+// The bot training environment behind include/vsync_env.h: a `PlayerBatch`
+// with a C API around it. Built as a shared library without GL, see the
+// `env` target in the Makefile.
+//
+
+#include "vsync_env.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "src/V2.h"
+#include "src/input.h"
+#include "src/world.h"
+#include "src/batch.h"
+#include "src/search.h"
+#include "src/room_stuff.h"
+
+static_assert (VSYNC_LEFT  == (int) search::A_left);
+static_assert (VSYNC_RIGHT == (int) search::A_right);
+static_assert (VSYNC_UP    == (int) search::A_up);
+static_assert (VSYNC_DOWN  == (int) search::A_down);
+static_assert (VSYNC_JUMP  == (int) search::A_jump);
+static_assert (VSYNC_DASH  == (int) search::A_dash);
+static_assert (VSYNC_CLIMB == (int) search::A_climb);
+
+constexpr int view_rx = VSYNC_VIEW_W / 2;
+constexpr int view_ry = VSYNC_VIEW_H / 2;
+constexpr int obs_size = VSYNC_OBS_HEADER + VSYNC_VIEW_W * VSYNC_VIEW_H;
+
+struct vsync_env
+{
+  const Level level;
+  const int room;
+  PlayerBatch batch;
+
+  std::vector <uint32_t> held; // the last action of every env
+
+  // Which tiles are solid, for the room plus a border as wide as the view,
+  // so the view never has to look anywhere else.
+  V2 <int> view_pos, view_size;
+  std::vector <uint8_t> solid;
+
+  vsync_env (Level && lvl, int room, int n_envs, V2 <coord> spawn)
+    : level { std::move (lvl) }
+    , room { room }
+    , batch { level, room, n_envs, spawn }
+    , held (n_envs, 0)
+  {
+    const auto & tm = level.tilemaps[room];
+    view_pos  = { tm.pos.x - view_rx, tm.pos.y - view_ry };
+    view_size = { tm.size.x + 2 * view_rx, tm.size.y + 2 * view_ry };
+
+    solid.resize (view_size.x * view_size.y);
+    for (int y = 0; y < view_size.y; y++)
+    for (int x = 0; x < view_size.x; x++)
+      solid[x + y * view_size.x] = hit_test_int (level, { view_pos.x + x, view_pos.y + y });
+  }
+
+  float solid_at (int x, int y) const
+  {
+    x -= view_pos.x;
+    y -= view_pos.y;
+    if (x < 0 || y < 0 || x >= view_size.x || y >= view_size.y)
+      return 1;
+    return solid[x + y * view_size.x];
+  }
+};
+
+extern "C" {
+
+vsync_env * vsync_env_create (int n_envs, int room)
+{
+  const char * pth = std::getenv ("VSYNC_LEVEL");
+  if (! pth) pth = "lvl";
+
+  if (FILE * f = std::fopen (pth, "rb"))
+    std::fclose (f);
+  else
+    return nullptr;
+
+  if (n_envs < 1)
+    return nullptr;
+
+  try
+  {
+    Level level = load_level (pth);
+    if (room < 0 || room >= (int) level.tilemaps.size ())
+      return nullptr;
+
+    const auto spawn = room_spawn (level, room);
+    if (! spawn)
+      return nullptr;
+
+    return new vsync_env { std::move (level), room, n_envs, *spawn };
+  }
+  catch (...)
+  {
+    return nullptr;
+  }
+}
+
+void vsync_env_destroy (vsync_env * env)
+{
+  delete env;
+}
+
+int vsync_env_num_envs (const vsync_env * env)
+{
+  return env->batch.n;
+}
+
+int vsync_env_obs_size (void)
+{
+  return obs_size;
+}
+
+void vsync_env_reset (vsync_env * env, int i)
+{
+  if (i >= env->batch.n)
+    return;
+
+  const int lo = i < 0 ? 0 : i;
+  const int hi = i < 0 ? env->batch.n : i + 1;
+
+  for (int j = lo; j < hi; j++)
+  {
+    env->batch.reset (j);
+    env->held[j] = 0;
+  }
+}
+
+void vsync_env_step (vsync_env * env, const uint32_t * actions, uint8_t * done)
+{
+  auto & b = env->batch;
+
+  // Turn changes in the held keys into key events, like a keyboard would
+  for (int i = 0; i < b.n; i++)
+  {
+    const uint32_t a = actions[i];
+    const uint32_t changed = a ^ env->held[i];
+    if (! changed) continue;
+
+    for (int k = 0; k < (int) std::size (search::action_keys); k++)
+      if (changed & (1 << k))
+        b.on_key (i, search::action_keys[k] (), (a & (1 << k)) ? key_press : key_release);
+
+    env->held[i] = a;
+  }
+
+  b.step ();
+
+  for (int i = 0; i < b.n; i++)
+  {
+    const bool left = b.left_room (i);
+    if (left)
+    {
+      b.reset (i);
+      env->held[i] = 0;
+    }
+    if (done)
+      done[i] = left;
+  }
+}
+
+void vsync_env_observe (const vsync_env * env, float * buf)
+{
+  const auto & b = env->batch;
+  const auto & tm = env->level.tilemaps[env->room];
+
+  for (int i = 0; i < b.n; i++)
+  {
+    float * o = buf + (size_t) i * obs_size;
+
+    o[0] = (float) (b.px[i] - tm.pos.x);
+    o[1] = (float) (b.py[i] - tm.pos.y);
+    o[2] = (float) b.vx[i];
+    o[3] = (float) b.vy[i];
+    o[4] = b.facing[i];
+    o[5] = b.n_dashes[i];
+    o[6] = b.dash_state[i] != Player::NotDashing;
+    o[7] = b.grounded[i];
+
+    const int cx = tile_floor (b.px[i] + Player::size.x / 2);
+    const int cy = tile_floor (b.py[i] + Player::size.y / 2);
+
+    float * v = o + VSYNC_OBS_HEADER;
+    for (int y = -view_ry; y <= view_ry; y++)
+    for (int x = -view_rx; x <= view_rx; x++)
+      *v++ = env->solid_at (cx + x, cy + y);
+  }
+}
+
+}
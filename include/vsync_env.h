@@ -0,0 +1,112 @@
+#ifndef VSYNC_ENV_H
+#define VSYNC_ENV_H
+
+/*
+ * Many copies of the game in one room, for training bots.
+ *
+ * Built as build/libvsync_env.so (`make env`), without any GL. Everything
+ * runs in the caller's process: `vsync_env_step` takes one action per env and
+ * `vsync_env_observe` writes every env's observation straight into a buffer
+ * the caller owns, so nothing has to be serialized between steps.
+ *
+ *   vsync_env * e = vsync_env_create (4096, 6);
+ *   float * obs = malloc (sizeof (float) * 4096 * vsync_env_obs_size ());
+ *   uint32_t * actions = ...;
+ *   uint8_t * done = ...;
+ *
+ *   for (;;)
+ *   {
+ *     vsync_env_observe (e, obs);
+ *     ... pick actions ...
+ *     vsync_env_step (e, actions, done);
+ *   }
+ *
+ * The level is read from the file "lvl" in the working directory, or from
+ * the file named by the VSYNC_LEVEL environment variable.
+ */
+
+#include <stdint.h>
+
+/*
+ * The library is built with -fvisibility=hidden, so these functions are
+ * all it exports.
+ */
+#if defined(__GNUC__)
+#define VSYNC_API __attribute__ ((visibility ("default")))
+#else
+#define VSYNC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct vsync_env vsync_env;
+
+/* Actions are the keys held down during a step, one bit each. */
+enum
+{
+  VSYNC_LEFT  = 1 << 0,
+  VSYNC_RIGHT = 1 << 1,
+  VSYNC_UP    = 1 << 2,
+  VSYNC_DOWN  = 1 << 3,
+  VSYNC_JUMP  = 1 << 4,
+  VSYNC_DASH  = 1 << 5,
+  VSYNC_CLIMB = 1 << 6
+};
+
+/*
+ * The egocentric solidity window is VSYNC_VIEW_W x VSYNC_VIEW_H tiles,
+ * centered on the tile under the middle of the player, row by row from the
+ * top left.
+ */
+enum
+{
+  VSYNC_VIEW_W = 15,
+  VSYNC_VIEW_H = 11
+};
+
+/*
+ * Layout of one observation, in floats:
+ *
+ *   [0] x, [1] y     position of the player's top left corner, in tiles,
+ *                    relative to the top left corner of the room
+ *   [2] vx, [3] vy   velocity
+ *   [4] facing       -1 or 1
+ *   [5] dashes       dashes left
+ *   [6] dashing      1 while dashing
+ *   [7] grounded     1 when standing on something
+ *   [8] ...          the window, 1 for solid tiles and 0 for empty ones
+ */
+enum
+{
+  VSYNC_OBS_HEADER = 8
+};
+
+/* Returns NULL if the level can't be loaded or `room` doesn't exist. */
+VSYNC_API vsync_env * vsync_env_create (int n_envs, int room);
+VSYNC_API void        vsync_env_destroy (vsync_env * env);
+
+VSYNC_API int vsync_env_num_envs (const vsync_env * env);
+
+/* Floats per observation: VSYNC_OBS_HEADER + VSYNC_VIEW_W * VSYNC_VIEW_H */
+VSYNC_API int vsync_env_obs_size (void);
+
+/* Puts env `i` back at the start of the room, or all of them if `i` < 0. */
+VSYNC_API void vsync_env_reset (vsync_env * env, int i);
+
+/*
+ * Advances every env by one tick, holding the keys in `actions[i]` for
+ * env `i`. Envs where the player left the room get `done[i]` = 1 and are
+ * reset; the others get 0. `done` may be NULL.
+ */
+VSYNC_API void vsync_env_step (vsync_env * env, const uint32_t * actions, uint8_t * done);
+
+/* Writes `vsync_env_num_envs` observations to `buf`, one after the other. */
+VSYNC_API void vsync_env_observe (const vsync_env * env, float * buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,6 +17,9 @@
 #include "src/input.h"
 #include "src/room_stuff.h"
 #include "src/entity.h"
+#include "src/world.h"
+#include "src/replay.h"
+#include "src/rewind.h"
 
 // ----------
 
@@ -27,11 +30,46 @@ unsigned int window_width  = 800;
 unsigned int window_height = 600;
 
 GLFWwindow * window;
-/*Shader shader, simple_shader;*/
-glm::vec3 cam { 0, 0, 0 };
+InputRecorder recorder;
+Rewind history;
+bool rewinding = false; // the rewind key is held down, see `processInput`
+Shader shader, simple_shader;
 
-std::vector<TileMapEx> tilemaps;
-/*std::vector<Entity *> entities;*/
+Level level;
+World world { level };
+
+// In fixed step mode we usually render somewhere in between two ticks,
+// so we keep the previous state around to interpolate from.
+struct RenderState
+{
+  V2 <float> player_pos;
+  Camera cam;
+  int screen;
+};
+RenderState prev_render_state;
+
+RenderState current_render_state ()
+{
+  return RenderState
+    { .player_pos = to_float (world.player.pos)
+    , .cam        = world.cam
+    , .screen     = world.current_screen
+    };
+}
+
+RenderState interpolate (const RenderState & a, const RenderState & b, float t)
+{
+  if (a.screen != b.screen) // don't sweep across the world when changing screens
+    return b;
+
+  const auto mix = [t] (float x, float y) { return x + (y - x) * t; };
+
+  return RenderState
+    { .player_pos = { mix (a.player_pos.x, b.player_pos.x), mix (a.player_pos.y, b.player_pos.y) }
+    , .cam        = { mix (a.cam.x, b.cam.x), mix (a.cam.y, b.cam.y), mix (a.cam.z, b.cam.z) }
+    , .screen     = b.screen
+    };
+}
 
 // ----------
 
@@ -72,139 +110,46 @@ bool key_pressed (int key)
   return glfwGetKey (window, key) != GLFW_RELEASE;
 }
 
-template <class T>
-bool pt_in_rect (V2 <T> p1, V2 <T> p2, V2 <T> size)
-{
-  if (p1.x < p2.x || p1.y < p2.y) return false;
-  const V2 <T> p3 { p2.x+size.x, p2.y+size.y };
-  if (p1.x >= p3.x || p1.y >= p3.y) return false;
-  return true;
-}
-
-template <class T>
-bool rect_in_rect (V2 <T> p1, V2 <T> s1, V2 <T> p2, V2 <T> s2)
-{
-  return std::max(p1.x, p2.x) < std::min(p1.x + s1.x, p2.x + s2.x)
-      && std::max(p1.y, p2.y) < std::min(p1.y + s1.y, p2.y + s2.y);
-}
-
-bool hit_test_int (V2 <int> pos)
-{
-  for (auto tm : tilemaps)
-  {
-    if (pt_in_rect <int> (pos, tm.pos, tm.size))
-    {
-      const V2 <int> lpos { pos.x - tm.pos.x, pos.y - tm.pos.y };
-      const auto & tile = tm[lpos];
-      return tile.is_nonempty();
-    }
-  }
-  return false;
-}
+// ----
 
-bool hit_test (V2 <float> pos)
+void render_particles (const Particles & particles, glm::mat4 model)
 {
-  return hit_test_int ({(int) pos.x, (int) pos.y});
-}
+  simple_shader.use ();
 
-bool hit_test (V2 <float> p1, V2 <float> s1)
-{
-  for (auto tm : tilemaps)
+  for (const auto & p : particles.ps)
   {
-    const V2 <float> p2 { (float) tm.pos.x,  (float) tm.pos.y  };
-    const V2 <float> s2 { (float) tm.size.x, (float) tm.size.y };
-    if (rect_in_rect (p1,s1,p2,s2))
-    {
-      const int x0 = std::max<int>((int) p1.x, tm.pos.x) - tm.pos.x;
-      const int y0 = std::max<int>((int) p1.y, tm.pos.y) - tm.pos.y;
-      const int x1 = std::min<int>((int) (p1.x + s1.x), tm.pos.x + tm.size.x) - tm.pos.x;
-      const int y1 = std::min<int>((int) (p1.y + s1.y), tm.pos.y + tm.size.y) - tm.pos.y;
-
-      const int off_y = tm.pos.y < 0 ? -1 : 0; // why do I need this?
-
-      for (int y = y0; y <= y1; y++)
-      {
-        int y3 = y+off_y;
-        if (y3 < 0 || y3 >= tm.size.y) continue;
-        for (int x = x0; x <= x1; x++)
-        {
-          if (x < 0 || x >= tm.size.x) continue;
-          const auto & tile = tm[{x, y3}];
-          if (tile.is_nonempty())
-            return true;
-        }
-      }
-    }
+    const auto model_ = glm::translate(model, {p.pos.x - p.size.w/2, p.pos.y - p.size.h/2, 0.0});
+    simple_shader.setMat4("model", model_);
+    simple_shader.setVec2("size", p.size.w, p.size.h);
+    simple_shader.setVec4 ("color", p.r, p.g, p.b, p.alpha);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
   }
-  return false;
 }
 
-
 // ----
 
-// int current_screen = 0;
-// Player player
-//   (V2<float>{ 3, 16 }
-//   );
-
-// int current_screen = 12;
-// Player player
-//   (V2<float>{ 82+10, -174 + 17 }
-//   );
-
-int current_screen = 6;
-Player player
-  (V2<float>{ 162+8, -151 + 16 }
-  );
-
-int get_current_screen ()
-{
-  int i = 0;
-  for (auto tm : tilemaps)
-  {
-    const V2 <float> p1 { player.pos.x + player.size.x/2, player.pos.y + player.size.y/2};
-    const V2 <float> p2 { (float) tm.pos.x,  (float) tm.pos.y  };
-    const V2 <float> s2 { (float) tm.size.x, (float) tm.size.y };
-    if (pt_in_rect (p1,p2,s2))
-      return i;
-    i++;
-  }
-  return -1;
-}
-
 void main_tick ()
 {
   processInput(window);
 
-  if (global::is_frozen)
+  if (rewinding)
     return;
 
-  for (auto e : entities)
+  if (world.clock.is_frozen)
   {
-    e->tick ();
+    history.push (world);
+    return;
   }
 
-  player.tick ();
-  const int new_screen = get_current_screen ();
+  world.tick ();
 
-  if (new_screen >= 0 && current_screen != new_screen)
   {
-    current_screen = new_screen;
-    const auto tm = tilemaps[current_screen];
-    fmt::print("new screen: {}, {}, {}\n", current_screen, tm.pos.x, tm.pos.y);
-
-    particles->ps = {};
-    global::freeze_time (20); // sleep a bit after changing screens
-    player.n_dashes = 1;
-  }
-
-  {
-    const auto tm = tilemaps[current_screen];
+    const auto & tm = world.tilemaps()[world.current_screen];
     const float w = 40.f;
     const float h = w/window_width*window_height;
 
-    float x = player.pos.x - player.size.x/2 - w/2;
-    float y = player.pos.y - player.size.y/2 - h/2;
+    float x = (float) world.player.pos.x - (float) world.player.size.x/2 - w/2;
+    float y = (float) world.player.pos.y - (float) world.player.size.y/2 - h/2;
 
     if (auto x2 = tm.pos.x + tm.size.x - w; x > x2) x = x2;
     if (auto y2 = tm.pos.y + tm.size.y - h; y > y2) y = y2;
@@ -216,10 +161,12 @@ void main_tick ()
       y += (tm.size.y - h)/2;
     }
 
-    cam.x = -x;
-    cam.y = -y;
+    world.cam.x = -x;
+    world.cam.y = -y;
   }
 
+  history.push (world);
+
   // global::ticks_elapsed++;
 }
 
@@ -227,8 +174,14 @@ void main_tick ()
 
 void key_callback (GLFWwindow * win, int key, int scancode, int action, int mods);
 
-int main ()
+int main (int argc, char ** argv)
 {
+  if (argc > 2 && std::string (argv[1]) == "--record")
+  {
+    recorder.open (argv[2], { .screen = world.current_screen, .pos = world.player.pos });
+    fmt::print("recording inputs to {}\n", argv[2]);
+  }
+
   // glfw: initialize and configure
   // ------------------------------
   glfwInit();
@@ -282,13 +235,14 @@ int main ()
   // The `load_tilemaps` function automatically applies autotiling rules
   // to figure out which individual tile to use from within the given tileset.
   //
-  // We could do the autotiling in the render loop instead, but it's sort of expensive
-  // and hopefully they won't change at runtime.
+  // We could do the autotiling in the render loop instead, but it's sort of expensive.
+  // Tiles that change at runtime go through `set_tile`, which only redoes the tiles
+  // around the one that changed and tells `level.tiles_changed` which ones those were.
+  // The loop below draws straight from the tiles every frame, so it doesn't need telling.
   //
-  tilemaps = load_tilemaps ("lvl");
-  tilemaps.push_back(boring_screen ({100, 100}, {700, 140}));
-  fmt::print("got {} tilemaps!\n", tilemaps.size());
-  fmt::print("x: {}, y: {}\n", tilemaps[0].size.x, tilemaps[0].size.y);
+  level = load_level ("lvl");
+  fmt::print("got {} tilemaps!\n", world.tilemaps().size());
+  fmt::print("x: {}, y: {}\n", world.tilemaps()[0].size.x, world.tilemaps()[0].size.y);
 
 
   Texture texs [] =
@@ -352,37 +306,60 @@ int main ()
 
     // -------------------------
 
-    // init entities
-    {
-      init_entities ();
-    }
-
     glfwSetTime (0);
 
+    // Never try to catch up on more than this many seconds, or we would
+    // spiral into running ever more ticks per frame after a long stall.
+    const secs max_lag = 0.25;
+    secs lag = 0;
+    secs prev_time = 0;
+
     // main loop
     //
     while (!glfwWindowShouldClose(window))
     {
-      global::tick_time (glfwGetTime ());
+      RenderState rs;
 
-      if (0)
+      if constexpr (global::fixed_timestep)
       {
-        if (global::ticks_elapsed % 120 == 0)
+        const secs now = glfwGetTime ();
+        lag = std::min (lag + now - prev_time, max_lag);
+        prev_time = now;
+
+        while (lag >= global::intended_tick_time)
         {
-          fmt::print("tick_time: {}\n", 1.f / global::tick_time());
+          prev_render_state = current_render_state ();
+          world.clock.step ();
+          main_tick ();
+          recorder.put_hash (world.clock.frames_elapsed, world.state_hash);
+          lag -= global::intended_tick_time;
         }
+
+        rs = interpolate (prev_render_state, current_render_state (), lag / global::intended_tick_time);
+      }
+      else
+      {
+        world.clock.tick_time (glfwGetTime ());
+        main_tick ();
+        rs = current_render_state ();
       }
 
-      main_tick ();
+      if (0)
+      {
+        if (world.clock.ticks_elapsed % 120 == 0)
+        {
+          fmt::print("tick_time: {}\n", 1.f / world.clock.tick_time());
+        }
+      }
 
       glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
       glClear(GL_COLOR_BUFFER_BIT);
 
       glm::mat4 model = glm::mat4 (1.0f);
-      model = glm::translate(model, glm::vec3(cam.x,cam.y, 0.f));
+      model = glm::translate(model, glm::vec3(rs.cam.x,rs.cam.y, 0.f));
       {
         const float mult  = 0.1f;
-        float scale = 1.f + cam.z * mult;
+        float scale = 1.f + rs.cam.z * mult;
 
         model = glm::scale(model, glm::vec3(scale, scale, 1.f));
       }
@@ -393,7 +370,7 @@ int main ()
         shader.use ();
         glBindVertexArray(VAO);
 
-        auto tm = tilemaps[current_screen];
+        const auto & tm = world.tilemaps()[world.current_screen];
         /*for (auto & tm : tilemaps)*/
         {
           for (int y = 0; y < tm.size.y; y++)
@@ -423,13 +400,13 @@ int main ()
         simple_shader.use ();
         glBindVertexArray (VAO);
 
-        auto model_ = glm::translate(model, {player.pos.x, player.pos.y, 0.0});
+        auto model_ = glm::translate(model, {rs.player_pos.x, rs.player_pos.y, 0.0});
         simple_shader.setMat4("model", model_);
-        simple_shader.setVec2("size", player.size.x, player.size.y);
+        simple_shader.setVec2("size", (float) world.player.size.x, (float) world.player.size.y);
 
-        if (player.dash_state == Player::DirectionPending)
+        if (world.player.dash_state == Player::DirectionPending)
           simple_shader.setVec4 ("color", 1.f, 1.f, 1.f, 1.f);
-        else if (player.n_dashes == 0)
+        else if (world.player.n_dashes == 0)
           simple_shader.setVec4 ("color", 0.4f, 0.4f, 1.f, 1.f);
         else
           simple_shader.setVec4 ("color", 1.f, 0.f, 0.f, 1.f);
@@ -442,7 +419,9 @@ int main ()
         // const auto & tm = tilemaps[current_screen];
         // auto model_ = glm::translate (model, {tm.pos.x, tm.pos.y, 0});
 
-        for (auto e : entities)
+        render_particles (world.particles, model);
+
+        for (auto e : world.entities)
         {
           e->render (model);
         }
@@ -455,6 +434,7 @@ int main ()
     glDeleteVertexArrays(1, &VAO);
   }
 
+  recorder.close (world.clock.frames_elapsed);
   glfwTerminate();
 
   return 0;
@@ -469,10 +449,16 @@ void processInput(GLFWwindow *window)
   if (glfwGetKey(window, 'Q') == GLFW_PRESS)
       glfwSetWindowShouldClose(window, true);
 
+  // Hold to go back in time, one frame per frame, up to a minute. Not while
+  // recording, since the recording would no longer match what happened.
+  rewinding = glfwGetKey(window, 'R') == GLFW_PRESS && !recorder.recording ();
+  if (rewinding)
+    history.step_back (world);
+
   if (glfwGetKey(window, 'P') == GLFW_PRESS)
   {
-    const auto & tm = tilemaps[current_screen];
-    const auto p = player.pos - V2 <float> {(float) tm.pos.x, (float) tm.pos.y};
+    const auto & tm = world.tilemaps()[world.current_screen];
+    const auto p = to_float (world.player.pos) - V2 <float> {(float) tm.pos.x, (float) tm.pos.y};
     fmt::print("player pos: {}, {}\n", (int) p.x, (int) p.y);
   }
 }
@@ -508,17 +494,8 @@ void framebuffer_size_callback(GLFWwindow*, int width, int height)
   }
 }
 
-void key_callback (GLFWwindow * win, int key, int scancode, int action, int mods)
+void key_callback (GLFWwindow *, int key, int scancode, int action, int mods)
 {
-  global::keymap.put (global::ticks_elapsed, key,scancode,action,mods);
-
-  {
-    Key key = 'N';
-    if (key.fresh (1))
-    {
-      player.pos = V2 <float> { 100 + 5, 100 + 3 };
-    }
-  }
-
+  recorder.put (world.clock.frames_elapsed, key, action, mods);
+  world.on_key (key, scancode, action, mods);
 }
-
@@ -0,0 +1,713 @@
+// Headless simulation: runs the game logic without a window, OpenGL or vsync,
+// as fast as the CPU allows. Input comes from a script or a recording made
+// with `build/main --record <file>` instead of the keyboard.
+//
+//   build/sim [ticks] [threads]
+//   build/sim --replay <file>
+//   build/sim --search [--room N] [--exit left|right|top|bottom] [--beam N]
+//                      [--hold N] [--depth N] [--threads N] [--out <file>]
+//   build/sim --batch [lanes] [ticks]
+//   build/sim --rewind [ticks]
+//   build/sim --overlaps [entities] [ticks]
+//   build/sim --raycast [rays] [room] [distance]
+//   build/sim --edit [edits] [room]
+//   build/sim --convert <text level> <binary level>
+//
+// With more than one thread, each thread runs its own world on the same
+// level, all following the same script.
+//
+// `--replay` checks the state hashes stored in the recording (see hash.h)
+// against its own, and reports where the two first went apart.
+//
+// `--search` looks for the fastest way out of a room (see search.h) and
+// writes it as a recording, which `--replay` can play back.
+//
+// `--batch` runs many players with random inputs, once as separate worlds and
+// once as a `PlayerBatch` (see batch.h), and checks that both end up in the
+// same place.
+//
+// `--rewind` plays the default script into a `Rewind` ring (see rewind.h),
+// then rewinds all the way back, checking every frame on the way.
+//
+// `--overlaps` lets entities drift around the starting room and checks the
+// pairs `Broadphase` finds (see broadphase.h) against comparing every two.
+//
+// `--raycast` casts random rays around a room, the starting one unless told
+// otherwise (see raycast.h), 60 tiles long unless told otherwise, and checks
+// them against stepping along them a bit at a time with `hit_test`.
+//
+// `--edit` changes random tiles of a room, the starting one unless told
+// otherwise, with `set_tile`, and every so often checks the room, and what
+// the level knows about it, against ones built from scratch.
+//
+// `--convert` turns a text level into a binary one (see level_file.h). Both
+// kinds load the same way, from `lvl` in the current directory.
+//
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/V2.h"
+#include "src/input.h"
+#include "src/world.h"
+#include "src/replay.h"
+#include "src/search.h"
+#include "src/batch.h"
+#include "src/rewind.h"
+#include "src/raycast.h"
+#include "src/room_stuff.h"
+
+// ----------
+
+// A key press or release that happens on a given frame
+struct InputEvent
+{
+  tick_t frame;
+  int key;
+  int action;
+};
+
+struct InputScript
+{
+  std::vector <InputEvent> events {};
+  size_t next = 0;
+
+  void press (tick_t frame, Key key, tick_t hold)
+  {
+    events.push_back ({ frame,        key (), key_press   });
+    events.push_back ({ frame + hold, key (), key_release });
+  }
+
+  // Calls `fn` with every event that is due
+  template <class F>
+  void feed (tick_t frame, F fn)
+  {
+    while (next < events.size () && events[next].frame <= frame)
+      fn (events[next++]);
+  }
+
+  // Hands every event that is due to the world, like `key_callback` would
+  void feed (World & world, tick_t frame)
+  {
+    feed (frame, [&] (const InputEvent & e) { world.on_key (e.key, 0, e.action, 0); });
+  }
+};
+
+// Runs back and forth across the room, jumping and dashing along the way.
+// Not meant to get anywhere, just to exercise most of `Player::tick`.
+InputScript default_script (tick_t ticks)
+{
+  InputScript s {};
+
+  for (tick_t t = 0; t < ticks; t += 600)
+  {
+    s.press (t,       input::move_E, 290);
+    s.press (t + 300, input::move_W, 290);
+
+    for (tick_t j = 0; j < 600; j += 75)
+      s.press (t + j + 10, input::jump, 30);
+
+    s.press (t + 120, input::dash, 4);
+    s.press (t + 420, input::dash_down, 4);
+  }
+
+  std::stable_sort (s.events.begin (), s.events.end (),
+    [] (const InputEvent & a, const InputEvent & b) { return a.frame < b.frame; });
+
+  return s;
+}
+
+// Wanders around at random, mostly walking and falling, which is what
+// `PlayerBatch` is good at.
+InputScript random_script (Rng & rng, tick_t ticks)
+{
+  InputScript s {};
+
+  for (tick_t t = 0; t < ticks; t += 20 + rng.roll (100))
+  {
+    const Key dir = rng.roll (2) ? input::move_E : input::move_W;
+    s.press (t, dir, 10 + rng.roll (120));
+
+    if (rng.roll (3) == 0)
+      s.press (t + rng.roll (20), input::jump, 5 + rng.roll (40));
+    if (rng.roll (12) == 0)
+      s.press (t + rng.roll (20), input::dash, 4);
+  }
+
+  std::stable_sort (s.events.begin (), s.events.end (),
+    [] (const InputEvent & a, const InputEvent & b) { return a.frame < b.frame; });
+
+  return s;
+}
+
+// ----------
+
+// Runs `frames` frames, calling `feed` with the frame number whenever
+// input would have been polled, in the same order as main.cpp does.
+template <class F>
+void run (World & world, tick_t frames, F feed)
+{
+  feed (world.clock.frames_elapsed);
+
+  for (tick_t i = 0; i < frames; i++)
+  {
+    // The clock advances by exactly one intended tick per frame, so the
+    // simulation behaves as if it was running at `intended_ticks_per_sec`.
+    world.step ();
+
+    feed (world.clock.frames_elapsed);
+  }
+}
+
+// ----------
+
+int search_main (const Level & level, int argc, char ** argv)
+{
+  const World def { level };
+  int room = def.current_screen;
+  V2 <coord> pos = def.player.pos;
+
+  search::Edge exit = search::Right;
+  int beam = 256, hold = 4, threads = std::thread::hardware_concurrency ();
+  tick_t depth = 2000;
+  const char * out = "route.vsr";
+
+  for (int i = 2; i + 1 < argc; i += 2)
+  {
+    const std::string a = argv[i];
+    const char * v = argv[i+1];
+
+    if      (a == "--room")    room    = std::atoi (v);
+    else if (a == "--beam")    beam    = std::max (1, std::atoi (v));
+    else if (a == "--hold")    hold    = std::max (1, std::atoi (v));
+    else if (a == "--depth")   depth   = std::strtoull (v, nullptr, 10);
+    else if (a == "--threads") threads = std::max (1, std::atoi (v));
+    else if (a == "--out")     out     = v;
+    else if (a == "--exit")
+    {
+      const std::string e = v;
+      exit = e == "left" ? search::Left
+           : e == "top"  ? search::Top
+           : e == "bottom" ? search::Bottom
+           : search::Right;
+    }
+    else
+    {
+      fmt::print ("unknown option: {}\n", a);
+      return 1;
+    }
+  }
+
+  // Start from the room's respawn point
+  if (room != def.current_screen)
+  {
+    const auto spawn = room_spawn (level, room);
+    if (! spawn)
+    {
+      fmt::print ("no respawn point for room {}\n", room);
+      return 1;
+    }
+    pos = *spawn;
+  }
+
+  RouteSearch s { level, room, pos, threads };
+  s.exit       = exit;
+  s.beam_width = beam;
+  s.hold       = hold;
+  s.max_frames = depth;
+
+  const auto t0 = std::chrono::steady_clock::now ();
+  const auto route = s.run ();
+  const auto t1 = std::chrono::steady_clock::now ();
+  const double secs = std::chrono::duration <double> (t1 - t0).count ();
+
+  if (! route.found)
+  {
+    fmt::print ("no route out of room {} found in {:.3f}s\n", room, secs);
+    return 1;
+  }
+
+  s.save (route, out);
+  fmt::print ("found a route out of room {} in {} ticks ({} key events) in {:.3f}s, saved to {}\n"
+             , room, route.frames, route.events.size (), secs, out);
+  return 0;
+}
+
+int batch_main (const Level & level, int argc, char ** argv)
+{
+  const int lanes = argc > 2 ? std::max (1, std::atoi (argv[2])) : 4096;
+  const tick_t ticks = argc > 3 ? std::strtoull (argv[3], nullptr, 10) : 10000;
+
+  World start { level };
+  start.verbose = false;
+
+  // Players that leave the room start over, with the rest of their script
+  std::vector <InputScript> scripts;
+  for (int i = 0; i < lanes; i++)
+  {
+    Rng rng { 0x9e3779b97f4a7c15 * (i + 1) };
+    scripts.push_back (random_script (rng, ticks));
+  }
+
+  const auto time = [] (auto fn)
+  {
+    const auto t0 = std::chrono::steady_clock::now ();
+    fn ();
+    return std::chrono::duration <double> (std::chrono::steady_clock::now () - t0).count ();
+  };
+
+  // One world per player
+  std::vector <World> worlds (lanes, start);
+  auto ss = scripts;
+  const double scalar_s = time ([&]
+  {
+    for (tick_t f = 0; f < ticks; f++)
+    for (int i = 0; i < lanes; i++)
+    {
+      ss[i].feed (worlds[i], f);
+      worlds[i].step ();
+      if (worlds[i].current_screen != start.current_screen)
+        worlds[i] = start;
+    }
+  });
+
+  // All of them at once
+  PlayerBatch b { level, start.current_screen, lanes, start.player.pos };
+  ss = scripts;
+  const double batch_s = time ([&]
+  {
+    for (tick_t f = 0; f < ticks; f++)
+    {
+      for (int i = 0; i < lanes; i++)
+        ss[i].feed (f, [&] (const InputEvent & e) { b.on_key (i, e.key, e.action); });
+      b.step ();
+      for (int i = 0; i < lanes; i++)
+        if (b.left_room (i))
+          b.reset (i);
+    }
+  });
+  b.flush ();
+
+  int mismatches = 0;
+  for (int i = 0; i < lanes; i++)
+  {
+    const auto & p = worlds[i].player;
+    const auto & q = b.worlds[i].player;
+    if (p.pos.x != q.pos.x || p.pos.y != q.pos.y || p.vel.x != q.vel.x || p.vel.y != q.vel.y)
+      mismatches++;
+  }
+
+  const double n = (double) lanes * ticks;
+  fmt::print ("{} players x {} ticks\n", lanes, ticks);
+  fmt::print ("scalar: {:.3f}s, {:.0f} ticks/sec\n", scalar_s, n / scalar_s);
+  fmt::print ("batch:  {:.3f}s, {:.0f} ticks/sec, {:.1f}x, {:.1f}% of ticks on the fast path\n"
+             , batch_s, n / batch_s, scalar_s / batch_s
+             , 100.0 * b.fast_ticks / std::max <uint64_t> (1, b.fast_ticks + b.slow_ticks));
+  fmt::print ("{} of {} players ended up somewhere else\n", mismatches, lanes);
+
+  return mismatches ? 1 : 0;
+}
+
+int rewind_main (const Level & level, int argc, char ** argv)
+{
+  const tick_t ticks = argc > 2 ? std::strtoull (argv[2], nullptr, 10) : 20000;
+
+  World world { level };
+  world.verbose = false;
+
+  // The state hash doesn't cover the particles, so add them in
+  const auto fingerprint = [] (const World & w)
+  {
+    StateHash h = w.state_hash;
+    for (const auto & p : w.particles.ps)
+      h.add (p.pos, p.vel, p.size, p.birth, p.ttl, p.alpha);
+    return h.value ();
+  };
+
+  Rewind rw {};
+  std::vector <uint64_t> expect;
+  double push_s = 0;
+
+  InputScript script = default_script (ticks);
+  run (world, ticks, [&] (tick_t frame)
+  {
+    script.feed (world, frame);
+
+    const auto t0 = std::chrono::steady_clock::now ();
+    rw.push (world);
+    push_s += std::chrono::duration <double> (std::chrono::steady_clock::now () - t0).count ();
+
+    expect.push_back (fingerprint (world));
+  });
+
+  const tick_t kept = rw.frames;
+  fmt::print ("{} frames, keeping the last {} in {:.2f} MB, {:.2f} us per push\n"
+             , expect.size (), kept, rw.bytes () / 1e6, push_s / expect.size () * 1e6);
+
+  int mismatches = 0;
+  const auto t0 = std::chrono::steady_clock::now ();
+  for (tick_t i = 1; i < kept; i++)
+  {
+    rw.step_back (world);
+    if (fingerprint (world) != expect[expect.size () - 1 - i])
+      mismatches++;
+  }
+  const double back_s = std::chrono::duration <double> (std::chrono::steady_clock::now () - t0).count ();
+
+  fmt::print ("rewound {} frames, {:.2f} us per frame, {} of them came back wrong\n"
+             , kept - 1, back_s / std::max <tick_t> (1, kept - 1) * 1e6, mismatches);
+
+  return mismatches ? 1 : 0;
+}
+
+// Something that drifts around and counts what it bumps into
+struct Drifter : Entity
+{
+  V2 <coord> vel {};
+  V2 <int> lo {}, hi {}; // where it bounces
+  int touches = 0;
+
+  void tick (World &) override
+  {
+    pos += vel;
+    if (pos.x < lo.x || pos.x + size.x > hi.x) vel.x = -vel.x;
+    if (pos.y < lo.y || pos.y + size.y > hi.y) vel.y = -vel.y;
+  }
+  void overlap (World &, Entity &) override
+  {
+    touches++;
+  }
+  void touch_player (World &) override
+  {
+    touches++;
+  }
+};
+
+int overlaps_main (const Level & level, int argc, char ** argv)
+{
+  const int    n     = argc > 2 ? std::max (1, std::atoi (argv[2])) : 2000;
+  const tick_t ticks = argc > 3 ? std::strtoull (argv[3], nullptr, 10) : 1000;
+
+  World world { level };
+  world.verbose = false;
+
+  const auto & tm = world.tilemaps ()[world.current_screen];
+  Rng rng {};
+  std::vector <Drifter> ds (n);
+  for (auto & d : ds)
+  {
+    d.lo   = tm.pos;
+    d.hi   = tm.pos + tm.size;
+    d.size = V2 <coord> { 0.5f + rng.rollf (), 0.5f + rng.rollf () };
+    d.pos  = V2 <coord> { tm.pos.x + rng.rollf () * (tm.size.x - 2), tm.pos.y + rng.rollf () * (tm.size.y - 2) };
+    d.vel  = V2 <coord> { (rng.rollf () - 0.5f) * 0.2f, (rng.rollf () - 0.5f) * 0.2f };
+    world.entities.push_back (&d);
+  }
+
+  // Every two boxes, the slow way
+  const auto brute_force = [&]
+  {
+    const auto & bs = world.overlaps.boxes;
+    size_t pairs = 0;
+    for (size_t i = 0; i < bs.size (); i++)
+      for (size_t j = i + 1; j < bs.size (); j++)
+        pairs += bs[i].x0 < bs[j].x1 && bs[j].x0 < bs[i].x1
+              && bs[i].y0 < bs[j].y1 && bs[j].y0 < bs[i].y1;
+    return pairs;
+  };
+
+  size_t pairs = 0, wrong = 0;
+  double find_s = 0;
+  for (tick_t i = 0; i < ticks; i++)
+  {
+    world.clock.step ();
+    for (auto e : world.entities)
+      e->tick (world);
+
+    const auto t0 = std::chrono::steady_clock::now ();
+    world.find_overlaps ();
+    find_s += std::chrono::duration <double> (std::chrono::steady_clock::now () - t0).count ();
+
+    pairs += world.overlaps.pairs.size ();
+    if (i % 100 == 0 && brute_force () != world.overlaps.pairs.size ())
+      wrong++;
+  }
+
+  fmt::print ("{} entities, {:.1f} overlaps per tick, {:.2f} us per tick, {} of {} checked ticks wrong\n"
+             , n, (double) pairs / ticks, find_s / ticks * 1e6, wrong, (ticks + 99) / 100);
+
+  return wrong ? 1 : 0;
+}
+
+int raycast_main (const Level & level, int argc, char ** argv)
+{
+  const int n = argc > 2 ? std::max (1, std::atoi (argv[2])) : 100000;
+  const float max_dist = argc > 4 ? std::max (1.f, (float) std::atof (argv[4])) : 60, step = 1.0 / 32;
+
+  const World def { level };
+  const int room = argc > 3 ? std::atoi (argv[3]) : def.current_screen;
+  if (room < 0 || room >= (int) level.tilemaps.size ())
+  {
+    fmt::print ("no room {}\n", room);
+    return 1;
+  }
+  const auto & tm = level.tilemaps[room];
+
+  Rng rng {};
+  std::vector <Ray> rays (n);
+  for (auto & r : rays)
+  {
+    r.origin   = { tm.pos.x + rng.rollf () * tm.size.x, tm.pos.y + rng.rollf () * tm.size.y };
+    r.dir      = { rng.rollf () - 0.5f, rng.rollf () - 0.5f };
+    if (rng.roll (8) == 0) // straight ones too
+      (rng.roll (2) ? r.dir.x : r.dir.y) = 0;
+    r.max_dist = max_dist;
+  }
+
+  std::vector <RayHit> hits (n);
+  auto t0 = std::chrono::steady_clock::now ();
+  raycasts (level, rays.data (), hits.data (), n);
+  const double cast_s = std::chrono::duration <double> (std::chrono::steady_clock::now () - t0).count ();
+
+  // Stepping along the ray finds the same wall, or one further on if it
+  // stepped over a corner, never one before it
+  int wrong = 0, hit = 0;
+  t0 = std::chrono::steady_clock::now ();
+  for (int i = 0; i < n; i++)
+  {
+    const Ray & r = rays[i];
+    const float len = std::sqrt (r.dir.x * r.dir.x + r.dir.y * r.dir.y);
+    if (len == 0) continue;
+
+    float t = 0;
+    for (; t <= max_dist; t += step)
+    {
+      const V2 <float> p { r.origin.x + r.dir.x / len * t, r.origin.y + r.dir.y / len * t };
+      if (hit_test_int (level, { (int) std::floor (p.x), (int) std::floor (p.y) }))
+        break;
+    }
+
+    const RayHit & h = hits[i];
+    hit += h.hit;
+    if (h.hit ? ! hit_test_int (level, h.tile) || t < h.dist - 1e-3 : t <= max_dist - step)
+      wrong++;
+  }
+  const double step_s = std::chrono::duration <double> (std::chrono::steady_clock::now () - t0).count ();
+
+  fmt::print ("{} rays, {} hit something, {:.3f} us per ray, {:.3f} us stepping, {} wrong\n"
+             , n, hit, cast_s / n * 1e6, step_s / n * 1e6, wrong);
+
+  return wrong ? 1 : 0;
+}
+
+// Whether `a` is everything `b` is: the same tiles, and the same solid
+// bits, runs and blocks for collisions
+bool same_room (const TileMapEx & a, const TileMapEx & b)
+{
+  for (int y = 0; y < a.size.y; y++)
+    for (int x = 0; x < a.size.x; x++)
+    {
+      const TileInfo & ta = a[{x, y}], & tb = b[{x, y}];
+      if (ta.tileset != tb.tileset || ta.tx != tb.tx || ta.ty != tb.ty) return false;
+      if (a.is_solid ({x, y}) != b.is_solid ({x, y})) return false;
+      for (const auto d : { TileMapEx::Left, TileMapEx::Right, TileMapEx::Up, TileMapEx::Down })
+        if (a.run ({x, y}, d) != b.run ({x, y}, d)) return false;
+    }
+
+  for (int l = 0; l < 2; l++)
+    for (int y = 0; y < a.block_dims[l].y; y++)
+      for (int x = 0; x < a.block_dims[l].x; x++)
+        if (a.block (l, {x, y}) != b.block (l, {x, y})) return false;
+  return true;
+}
+
+int edit_main (Level & level, int argc, char ** argv)
+{
+  const int n = argc > 2 ? std::max (1, std::atoi (argv[2])) : 100000;
+  const int check_every = 64;
+
+  const World def { level };
+  const int room = argc > 3 ? std::atoi (argv[3]) : def.current_screen;
+  if (room < 0 || room >= (int) level.tilemaps.size ())
+  {
+    fmt::print ("no room {}\n", room);
+    return 1;
+  }
+  const auto & tm = level.tilemaps[room];
+
+  uint64_t changes = 0, dirty = 0;
+  TileRange last {};
+  level.tiles_changed = [&] (int, TileRange d)
+  {
+    changes++;
+    dirty += (d.p1.x - d.p0.x + 1) * (d.p1.y - d.p0.y + 1);
+    last = d;
+  };
+
+  Rng rng {};
+  std::vector <TileInfo> before;
+  int wrong = 0, checks = 0;
+  double edit_s = 0, build_s = 0;
+  for (int i = 0; i < n; i++)
+  {
+    const V2 <int> p { rng.roll (tm.size.x), rng.roll (tm.size.y) };
+    const tile_t t = rng.roll (2) ? 0 : 1 + rng.roll (4);
+
+    const bool check = i % check_every == check_every - 1;
+    if (check)
+      before.assign (tm.tiles, tm.tiles + tm.size.x * tm.size.y);
+
+    const uint64_t changes0 = changes;
+    auto t0 = std::chrono::steady_clock::now ();
+    set_tile (level, room, p, t);
+    edit_s += std::chrono::duration <double> (std::chrono::steady_clock::now () - t0).count ();
+    if (! check) continue;
+
+    t0 = std::chrono::steady_clock::now ();
+    const TileMapEx fresh (tm.raw ());
+    build_s += std::chrono::duration <double> (std::chrono::steady_clock::now () - t0).count ();
+    checks++;
+
+    RoomIndex index {};
+    index.build (level.tilemaps);
+
+    // Nothing changed outside of what we were told about
+    bool ok = same_room (tm, fresh) && index.occupancy == level.rooms.occupancy;
+    for (int y = 0; y < tm.size.y; y++)
+      for (int x = 0; x < tm.size.x; x++)
+      {
+        const TileInfo & a = before[y * tm.size.x + x], & b = tm[{x, y}];
+        const bool changed = a.tileset != b.tileset || a.tx != b.tx || a.ty != b.ty;
+        const bool told = changes != changes0 && x >= last.p0.x && x <= last.p1.x && y >= last.p0.y && y <= last.p1.y;
+        if (changed && ! told) ok = false;
+      }
+    wrong += ! ok;
+  }
+
+  fmt::print ("{} edits to a {}x{} room, {} changed something, {:.2f} tiles redone each\n"
+             , n, tm.size.x, tm.size.y, changes, changes ? (double) dirty / changes : 0.0);
+  fmt::print ("{:.3f} us per edit, {:.3f} us rebuilding the room, {} of {} checks wrong\n"
+             , edit_s / n * 1e6, checks ? build_s / checks * 1e6 : 0.0, wrong, checks);
+
+  return wrong ? 1 : 0;
+}
+
+int main (int argc, char ** argv)
+{
+  if (argc > 3 && std::string (argv[1]) == "--convert")
+  {
+    const size_t n = convert_level (argv[2], argv[3]);
+    fmt::print ("wrote {} rooms to {}\n", n, argv[3]);
+    return 0;
+  }
+
+  const auto t0_load = std::chrono::steady_clock::now ();
+  Level level = load_level ("lvl");
+  const double load_s = std::chrono::duration <double> (std::chrono::steady_clock::now () - t0_load).count ();
+
+  if (argc > 1 && std::string (argv[1]) == "--search")
+    return search_main (level, argc, argv);
+  if (argc > 1 && std::string (argv[1]) == "--batch")
+    return batch_main (level, argc, argv);
+  if (argc > 1 && std::string (argv[1]) == "--rewind")
+    return rewind_main (level, argc, argv);
+  if (argc > 1 && std::string (argv[1]) == "--overlaps")
+    return overlaps_main (level, argc, argv);
+  if (argc > 1 && std::string (argv[1]) == "--raycast")
+    return raycast_main (level, argc, argv);
+  if (argc > 1 && std::string (argv[1]) == "--edit")
+    return edit_main (level, argc, argv);
+
+  std::vector <World> worlds;
+  tick_t ticks;
+  bool desync_found = false;
+  const auto t0 = std::chrono::steady_clock::now ();
+
+  if (argc > 2 && std::string (argv[1]) == "--replay")
+  {
+    InputReplay rep {};
+    rep.load (argv[2]);
+
+    World & world = worlds.emplace_back (level);
+    world.current_screen = rep.start.screen;
+    world.player = Player (rep.start.pos);
+
+    // The first recorded hash that doesn't match ours, and the last one that did
+    tick_t desync = 0, last_match = 0;
+    size_t n_hashes = 0;
+
+    ticks = rep.length ();
+    run (world, ticks, [&] (tick_t frame)
+    {
+      rep.feed (frame, [&] (const InputReplay::KeyEvent & e)
+      {
+        world.on_key (e.key, 0, e.action, e.mods);
+      },
+      [&] (const InputReplay::HashRecord & h)
+      {
+        n_hashes++;
+        if (desync) return;
+        if (h.hash == world.state_hash.value ())
+          last_match = h.frame;
+        else
+          desync = h.frame;
+      });
+    });
+
+    if (desync)
+    {
+      fmt::print ("desync: the replay went wrong between frames {} and {}\n", last_match, desync);
+      desync_found = true;
+    }
+    else if (n_hashes)
+      fmt::print ("all {} recorded state hashes match\n", n_hashes);
+  }
+  else
+  {
+    ticks = argc > 1 ? std::strtoull (argv[1], nullptr, 10) : 1000000;
+    const int n_threads = argc > 2 ? std::max (1, std::atoi (argv[2])) : 1;
+
+    worlds.resize (n_threads, World (level));
+    std::vector <std::thread> threads;
+
+    for (auto & world : worlds)
+    {
+      world.verbose = n_threads == 1;
+
+      threads.emplace_back ([&world, ticks]
+      {
+        InputScript script = default_script (ticks);
+        run (world, ticks, [&] (tick_t frame) { script.feed (world, frame); });
+      });
+    }
+    for (auto & t : threads)
+      t.join ();
+
+    ticks *= n_threads;
+  }
+
+  const auto t1 = std::chrono::steady_clock::now ();
+  const double s = std::chrono::duration <double> (t1 - t0).count ();
+
+  fmt::print ("level: {} rooms loaded in {:.2f} ms\n", level.tilemaps.size (), load_s * 1e3);
+  fmt::print ("{} ticks in {:.3f}s, {:.0f} ticks/sec, {:.0f}x real time\n"
+             , ticks, s, ticks / s, ticks / s / global::intended_ticks_per_sec);
+
+  for (const auto & world : worlds)
+  {
+    const auto & c = world.collisions;
+    fmt::print ("player: {}, {} in screen {}\n", world.player.pos.x, world.player.pos.y, world.current_screen);
+    fmt::print ("state hash: {:016x}\n", world.state_hash.value ());
+    fmt::print ("collisions: {} queries, {} boxes, {} of them looked up in {} batches\n"
+               , c.queries, c.boxes, c.slow, c.lookups);
+    fmt::print ("substeps: {} ticks split into {}, {} of them over budget\n"
+               , c.split, c.substeps, c.over_budget);
+  }
+
+  return desync_found ? 1 : 0;
+}
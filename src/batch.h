@@ -0,0 +1,1088 @@
+#pragma once
+
+#include "V2.h"
+#include "input.h"
+#include "player.h"
+#include "snapshot.h"
+#include "world.h"
+#include "sweep.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Many players in the same room, stepped in lockstep.
+//
+// A `Player` is a big object full of timers and branches, which is fine for
+// one player but hopeless for thousands. Most ticks are boring though: the
+// player is walking or falling, not dashing, jumping, climbing or landing.
+// `PlayerBatch` keeps everything those boring ticks look at in flat arrays
+// (one per field, not one per player) and runs them several lanes at a time
+// with vector instructions.
+//
+// Every lane also has a full `World`, and whenever a lane does something
+// interesting it takes the regular scalar path through `World::tick` instead.
+// Either way the player ends up exactly where `World::step` would have put
+// it. Particles are only for show, so the batch doesn't keep any, and
+// `World::state_hash` is not kept up to date either.
+//
+// About 99% of ticks take the fast path, landings and plain jumps included,
+// and around 40% of them are lanes standing still, which get skipped until a
+// key changes. What costs now is slides along walls, the slow ticks (dashes,
+// wall jumps, leaving the room) at around 1us each, and per-lane bookkeeping.
+// That comes to about 9x the scalar worlds at width 4.
+//
+// Input has to go through `on_key`, so that the batch sees it. The arrays
+// are where the players live; call `flush` before looking at `worlds`.
+
+namespace batch
+{
+  // GCC/Clang vector extensions, eight lanes with AVX (build with -mavx2)
+  // and four with plain SSE.
+#ifdef __AVX__
+  constexpr int width = 8;
+#else
+  constexpr int width = 4;
+#endif
+
+  using f32v = float   __attribute__ ((vector_size (width * 4)));
+  using i32v = int32_t __attribute__ ((vector_size (width * 4)));
+
+  template <class V, class T>
+  V vload (const T * p)
+  {
+    V v;
+    memcpy (&v, p, sizeof v);
+    return v;
+  }
+  template <class V, class T>
+  void vstore (T * p, V v)
+  {
+    memcpy (p, &v, sizeof v);
+  }
+
+  inline f32v signum (f32v a)
+  {
+    const f32v zero = {}, one = zero + 1;
+    return a < zero ? -one : a > zero ? one : zero;
+  }
+
+  // The keys the fast path cares about, one bit each in `PlayerBatch::held`
+  static constexpr Key keys [] =
+    { input::move_W
+    , input::move_E
+    , input::jump
+    , input::dash
+    , input::dash_down
+    , input::climb
+    , input::debug_key
+    , Key ('N') // the teleport in `World::on_key`
+    };
+  constexpr int n_keys = std::size (keys);
+
+  constexpr uint32_t
+    /*
+    */ K_left      = 1 << 0
+     , K_right     = 1 << 1
+     , K_jump      = 1 << 2
+     , K_dash      = 1 << 3
+     , K_dash_down = 1 << 4
+     , K_climb     = 1 << 5
+     , K_debug     = 1 << 6
+     , K_teleport  = 1 << 7
+     ;
+
+  // What `PlayerBatch::classify` tells the kernel, one bit each
+  constexpr int32_t
+    /*
+    */ L_fast     = 1 << 0  // nothing but walking/falling/jumping can happen this tick
+     , L_grounded = 1 << 1  // on the ground after `do_jumping`
+     , L_locked   = 1 << 2  // no_move_timer is alive
+     , L_no_fric  = 1 << 3  // no_fric_timer is alive
+     , L_jump     = 1 << 4  // jump is held
+     , L_zero_g   = 1 << 5  // zero_grav_timer is alive
+     , L_refresh  = 1 << 6  // `on_grounded` gives the dash back
+     , L_landed   = 1 << 7  // `do_grounding` found ground under us
+     , L_left     = 1 << 8  // `do_grounding` found none
+     , L_jumped   = 1 << 9  // a ground or cayotee jump
+     , L_ultra    = 1 << 10 // ... with an ultra boost
+     , L_dashing  = 1 << 11 // in the middle of a dash
+     , L_stable   = 1 << 12 // and the same next tick, unless the ground or a key changes
+
+       // and what the kernel tells `fast`
+     , L_still    = 1 << 13 // not moving
+     , L_far      = 1 << 14 // moving far enough to need substeps
+     , L_in_room  = 1 << 15 // ending up inside the room
+     ;
+}
+
+struct PlayerBatch
+{
+  using P = Player;
+
+  const Level & level;
+  const int room;
+  const int n;
+
+  World start;
+  Snapshot origin; // `start`, to reset lanes from without copying a whole `World`
+  std::vector <World> worlds;
+
+  // ---- the players, one entry per lane (padded to a multiple of `width`)
+
+  std::vector <coord>   px, py, vx, vy;
+  std::vector <int32_t> facing, n_dashes, dash_state;
+  std::vector <uint8_t> grounded, climbing, pending_ultra;
+  std::vector <int32_t> x_slide, y_slide;
+
+  // timer deadlines, see `Timer` and `Sec_Timer`
+  std::vector <tick_t>  no_fric_end, refresh_end, cooldown_end, cayotee_end, dash_end;
+  std::vector <secs>    no_move_end, zero_grav_end;
+  std::vector <tick_t>  last_jump, time_grounded, time_ungrounded;
+
+  // ---- the worlds around them
+
+  std::vector <Clock>    clocks;
+  std::vector <int>      screen;
+  std::vector <uint32_t> held;                  // `batch::keys`, as in the keymap
+  std::vector <tick_t>   t_key [batch::n_keys]; // ... and when they last changed
+
+  // Whether there is ground under the player's feet (not dashing), if
+  // `fast` already found out for where the player is now, or 2
+  std::vector <uint8_t>  ground;
+
+  // Lanes whose ticks change nothing but the clock, see `settled`. A key
+  // or the slow path wakes them up.
+  std::vector <uint8_t>  asleep;
+
+  // ---- per tick scratch
+
+  std::vector <int32_t> awake; // the lanes that aren't `asleep`, in order
+  std::vector <int32_t> bits;
+  std::vector <coord>   npx, npy, nvx, nvy;
+  std::vector <int32_t> nfacing, nn_dashes;
+
+  // ---- stats
+
+  uint64_t fast_ticks = 0, slow_ticks = 0;
+
+  PlayerBatch (const Level & level, int room, int n, V2 <coord> start)
+    : level { level }
+    , room { room }
+    , n { n }
+    , start { level }
+  {
+    this->start.verbose = false;
+    this->start.current_screen = room;
+    this->start.player = Player (start);
+    worlds.resize (n, this->start);
+    origin.save (this->start);
+
+    const int m = (n + batch::width - 1) / batch::width * batch::width;
+    for (auto * v : { &px, &py, &vx, &vy, &npx, &npy, &nvx, &nvy })
+      v->resize (m);
+    for (auto * v : { &facing, &n_dashes, &dash_state, &x_slide, &y_slide, &bits, &nfacing, &nn_dashes })
+      v->resize (m);
+    for (auto * v : { &grounded, &climbing, &pending_ultra })
+      v->resize (m);
+    for (auto * v : { &no_fric_end, &refresh_end, &cooldown_end, &cayotee_end, &dash_end, &last_jump, &time_grounded, &time_ungrounded })
+      v->resize (m);
+    for (auto & v : t_key)
+      v.resize (m);
+    for (auto * v : { &no_move_end, &zero_grav_end })
+      v->resize (m);
+    clocks.resize (m);
+    screen.resize (m);
+    held.resize (m);
+    last_slide.resize (m);
+    ground.resize (m, 2);
+    asleep.resize (m);
+    awake.resize (m);
+
+    for (int i = 0; i < n; i++)
+      load (i);
+
+    make_grid ();
+  }
+
+  // Like `World::on_key` for one lane. The keys the batch follows stay in
+  // `held` and `t_key` until `store` puts them in the keymap, so that input
+  // doesn't have to touch the lane's `World`.
+  void on_key (int lane, int key, int action)
+  {
+    using namespace batch;
+
+    const Clock & c = clocks[lane];
+    const tick_t  t = c.ticks_elapsed;
+
+    // `KeyMap::put`
+    int k = 0;
+    while (k < n_keys && keys[k] () != key)
+      k++;
+    if (k == n_keys)
+      worlds[lane].keymap.put (t, key, 0, action, 0);
+    else if ((action == key_press || action == key_release) && !! (held[lane] & 1 << k) != (action == key_press))
+    {
+      held[lane] ^= 1 << k;
+      t_key[k][lane] = t;
+    }
+
+    // `Key::fresh`, one tick long
+    if ((held[lane] & K_teleport) && t - t_key[n_keys - 1][lane] <= c.scaled_ticks (1))
+    {
+      px[lane] = 100 + 5;
+      py[lane] = 100 + 3;
+      ground[lane] = 2;
+    }
+    asleep[lane] = false;
+    bits[lane] &= ~L_stable;
+  }
+
+  // Puts a lane back where it started, e.g. after it left the room
+  void reset (int lane)
+  {
+    origin.restore (worlds[lane]);
+    load (lane);
+  }
+
+  bool left_room (int lane) const
+  {
+    return screen[lane] != room;
+  }
+
+  // Steps every lane by one tick, like `World::step`
+  void step ()
+  {
+    if (revision != level.revision)
+      make_grid ();
+
+    for (int i = 0; i < n; i++)
+      clocks[i].step ();
+
+    // Which lanes are asleep looks random from one lane to the next, so
+    // rather than branch on it everywhere, list the others once
+    int k = 0;
+    for (int i = 0; i < n; i++)
+    {
+      awake[k] = i;
+      k += ! asleep[i];
+    }
+    fast_ticks += n - k;
+
+    classify (k);
+
+    if (enabled)
+      for (int i = 0; i < n; i += batch::width)
+        if (const uint8_t * a = &asleep[i]; ! std::all_of (a, a + batch::width, [] (uint8_t z) { return z; }))
+          kernel (i);
+
+    for (int j = 0; j < k; j++)
+    {
+      const int i = awake[j];
+      if (clocks[i].is_frozen)
+        continue;
+
+      const int32_t xs = x_slide[i], ys = y_slide[i];
+      if (fast (i))
+      {
+        asleep[i] = settled (i, xs, ys);
+
+        px[i] = npx[i]; py[i] = npy[i];
+        vx[i] = nvx[i]; vy[i] = nvy[i];
+        facing[i]   = nfacing[i];
+        n_dashes[i] = nn_dashes[i];
+        land_and_jump (i);
+        fast_ticks++;
+      }
+      else
+      {
+        World & w = worlds[i];
+        store (i);
+        w.tick ();
+        w.particles.ps.clear ();
+        load (i);
+        slow_ticks++;
+      }
+    }
+  }
+
+  // Writes the arrays back into `worlds`
+  void flush ()
+  {
+    for (int i = 0; i < n; i++)
+      store (i);
+  }
+
+private:
+  void load (int i)
+  {
+    const World  & w = worlds[i];
+    const Player & p = w.player;
+
+    px[i] = p.pos.x; py[i] = p.pos.y;
+    vx[i] = p.vel.x; vy[i] = p.vel.y;
+    facing[i]     = p.facing;
+    n_dashes[i]   = p.n_dashes;
+    dash_state[i] = p.dash_state;
+    grounded[i]   = p.is_grounded;
+    climbing[i]   = p.is_climbing;
+    x_slide[i]    = p.x_slide;
+    y_slide[i]    = p.y_slide;
+    pending_ultra[i] = p.pending_ultra;
+
+    no_fric_end[i]     = p.no_fric_timer.deadline;
+    refresh_end[i]     = p.dash_refresh_timer.deadline;
+    cooldown_end[i]    = p.dash_cooldown_timer.deadline;
+    cayotee_end[i]     = p.cayotee_timer.deadline;
+    dash_end[i]        = p.dash_timer.deadline;
+    no_move_end[i]     = p.no_move_timer.deadline;
+    zero_grav_end[i]   = p.zero_grav_timer.deadline;
+    last_jump[i]       = p.time_last_jump;
+    time_grounded[i]   = p.time_grounded;
+    time_ungrounded[i] = p.time_ungrounded;
+    ground[i] = 2;
+    asleep[i] = false;
+    bits[i]   = 0;
+
+    clocks[i] = w.clock;
+    screen[i] = w.current_screen;
+
+    load_keys (i);
+  }
+
+  void load_keys (int i)
+  {
+    const World & w = worlds[i];
+
+    uint32_t h = 0;
+    for (int k = 0; k < batch::n_keys; k++)
+    {
+      if (batch::keys[k].pressed (w.keymap))
+        h |= 1 << k;
+      t_key[k][i] = batch::keys[k].time (w.keymap);
+    }
+    held[i] = h;
+  }
+
+  // Only what the fast path can change, plus the clock and the keys
+  void store (int i)
+  {
+    World  & w = worlds[i];
+    Player & p = w.player;
+
+    p.pos = { px[i], py[i] };
+    p.vel = { vx[i], vy[i] };
+    p.facing   = facing[i];
+    p.n_dashes = n_dashes[i];
+    p.x_slide  = x_slide[i];
+    p.y_slide  = y_slide[i];
+
+    p.is_grounded   = grounded[i];
+    p.pending_ultra = pending_ultra[i];
+    p.cayotee_timer.deadline   = cayotee_end[i];
+    p.zero_grav_timer.deadline = zero_grav_end[i];
+    p.time_last_jump  = last_jump[i];
+    p.time_grounded   = time_grounded[i];
+    p.time_ungrounded = time_ungrounded[i];
+
+    w.clock = clocks[i];
+
+    for (int k = 0; k < batch::n_keys; k++)
+      w.keymap.m[batch::keys[k] ()] = { .state = !! (held[i] & 1 << k), .time = t_key[k][i] };
+  }
+
+  // Whether lane `i` took a fast tick that changed nothing (`xs` and `ys`
+  // are the slide counters from before) and will keep doing that until a
+  // key changes: on the ground, standing or pushing against a wall, with
+  // no timer left that could still run out and make a difference.
+  bool settled (int i, int32_t xs, int32_t ys) const
+  {
+    using namespace batch;
+
+    const int32_t b = bits[i];
+    const auto same = [] (const std::vector <coord> & a, const std::vector <coord> & b, int i)
+    {
+      return memcmp (&a[i], &b[i], sizeof (coord)) == 0; // -0 isn't 0 here
+    };
+    return (b & (L_grounded | L_refresh | L_landed | L_dashing | L_locked | L_no_fric)) == (L_grounded | L_refresh)
+        && ! (held[i] & (K_dash | K_dash_down)) // they stay fresh for a while
+        && same (npx, px, i) && same (npy, py, i)
+        && same (nvx, vx, i) && same (nvy, vy, i)
+        && nfacing[i] == facing[i] && nn_dashes[i] == n_dashes[i]
+        && x_slide[i] == xs && y_slide[i] == ys;
+  }
+
+  // What `do_grounding` and `do_jumping` did besides moving the player,
+  // for a lane that took the fast path
+  void land_and_jump (int i)
+  {
+    using namespace batch;
+
+    const int32_t b = bits[i];
+    const tick_t  t = clocks[i].ticks_elapsed;
+
+    if (b & L_landed)
+    {
+      grounded[i]      = true;
+      cayotee_end[i]   = tick_t_never;
+      time_grounded[i] = t;
+    }
+    if (b & L_left)
+    {
+      grounded[i]        = false;
+      cayotee_end[i]     = t + decltype (P::cayotee_timer)::frames;
+      time_ungrounded[i] = t;
+    }
+    if (b & L_jumped)
+    {
+      if (grounded[i])
+      {
+        grounded[i]        = false;
+        cayotee_end[i]     = tick_t_never;
+        time_ungrounded[i] = t;
+      }
+      last_jump[i]     = t;
+      zero_grav_end[i] = secs (t) + P::zero_grav_time;
+      pending_ultra[i] = false;
+    }
+  }
+
+  // Works out which lanes could take the fast path this tick, going by
+  // everything except where the move ends up, and what the kernel needs to
+  // know about them. Mirrors `Player::tick` up to `do_movement`, in fixed
+  // step mode, where timers and key freshness count whole ticks. Only looks
+  // at the first `k` lanes in `awake`.
+  void classify (int k)
+  {
+    using namespace batch;
+
+    for (int j = 0; j < k; j++)
+    {
+      const int i = awake[j];
+      const tick_t t = clocks[i].ticks_elapsed;
+      const uint32_t h = held[i];
+
+      if (const int32_t o = bits[i]; (o & L_stable) && ground[i] == !! (o & L_grounded))
+      {
+        bits[i] = o & (L_still - 1);
+        continue;
+      }
+      bits[i] = 0;
+
+      if ( ! enabled
+        || clocks[i].is_frozen
+        || screen[i] != room
+        || climbing[i]
+        || (h & K_debug)
+         )
+        continue;
+
+      // Walking and falling, or dashing until `on_dashing` ends the dash
+      int32_t b = L_fast;
+      if (dash_state[i] == P::Dashing && t <= dash_end[i])
+        b |= L_dashing;
+      else if (dash_state[i] != P::NotDashing || (h & K_climb))
+        continue;
+
+      const tick_t t_jump = t_key[2][i], t_dash = t_key[3][i], t_dash_down = t_key[4][i]; // see `keys`
+      const auto fresh = [t] (bool held, tick_t pressed)
+      {
+        return held && t - pressed <= 8;
+      };
+
+      // do_grounding, unless `fast` already had a look
+      bool on_ground = ground[i];
+      if (ground[i] == 2 || (b & L_dashing))
+      {
+        const V2 <coord> feet { px[i], py[i] + P::size.y };
+        const float feet_h = b & L_dashing ? 0.40 : 0.15;
+        const V2 <coord> feet_size { P::size.x, feet_h };
+        if (! inside (feet, feet_size))
+          continue;
+        on_ground = solid (feet, feet_size);
+      }
+      bool g = on_ground;
+      tick_t cayotee = cayotee_end[i], ungrounded = time_ungrounded[i];
+
+      if (g && ! grounded[i])
+        { b |= L_landed; cayotee = tick_t_never; }
+      if (! g && grounded[i])
+        { b |= L_left; cayotee = t + decltype (P::cayotee_timer)::frames; ungrounded = t; }
+
+      // try_dash might dash. Keys stay fresh for a few ticks, but only the
+      // first of those ticks does anything.
+      const bool refresh = on_ground && t > refresh_end[i];
+      if ( ! (b & L_dashing)
+        && ( fresh (h & K_dash, t_dash) || fresh (h & K_dash_down, t_dash_down) )
+        && ( n_dashes[i] > 0 || refresh )
+        && t > cooldown_end[i]
+         )
+        continue;
+
+      // do_jumping, unless it might be a wall jump or bounce, or a super
+      const bool jumping = fresh (h & K_jump, t_jump) && t_jump > last_jump[i];
+      if (jumping)
+      {
+        if (b & L_dashing)
+          continue;
+        else if (g)
+          { b |= L_jumped; g = false; }
+        else if (t <= cayotee && ungrounded > last_jump[i])
+          b |= L_jumped;
+        else if (vx[i] == 0 && vy[i] < 0)
+          continue;
+        else
+        {
+          const float d = P::walljump_wall_dist;
+          const V2 <coord> l { px[i] - d, py[i] }, r { px[i] + P::size.x, py[i] }, s { d, P::size.y };
+          if (! inside (l, s) || ! inside (r, s) || solid (l, s) || solid (r, s))
+            continue;
+        }
+
+        if ((b & L_jumped) && pending_ultra[i])
+          b |= L_ultra;
+      }
+
+      if (g)                                             b |= L_grounded;
+      if (refresh)                                       b |= L_refresh;
+      if (no_move_end[i] > 0 && t <= no_move_end[i])     b |= L_locked;
+      if (t <= no_fric_end[i])                           b |= L_no_fric;
+      if (h & K_jump)                                    b |= L_jump;
+      if (zero_grav_end[i] > 0 && t <= zero_grav_end[i]) b |= L_zero_g;
+      if (b & L_jumped)                                  b |= L_zero_g;
+
+      // Nothing left that changes with time alone: no timer about to run
+      // out, no key about to go stale
+      if ( ! (b & (L_dashing | L_landed | L_left | L_jumped | L_locked | L_no_fric | L_zero_g))
+        && (refresh || ! on_ground)
+        && ! (h & (K_dash | K_dash_down))
+        && ! jumping
+         )
+        b |= L_stable;
+
+      bits[i] = b;
+    }
+  }
+
+  // What `do_grounding` and `do_jumping` do to the velocity, `do_movement`
+  // and `do_gravity` unless we are dashing, and the collision free part of
+  // `apply_velocity` for lanes [i, i + width). Writes the results to the
+  // n* arrays.
+  void kernel (int i)
+  {
+    using namespace batch;
+
+    const f32v zero = {}, one = zero + 1;
+    const i32v izero = {};
+
+    const i32v b = vload <i32v> (&bits[i]);
+    const i32v grounded = (b & L_grounded) != izero;
+    const i32v locked   = (b & L_locked)   != izero;
+    const i32v no_fric  = (b & L_no_fric)  != izero;
+    const i32v jump     = (b & L_jump)     != izero;
+    const i32v zero_g   = (b & L_zero_g)   != izero;
+    const i32v refresh  = (b & L_refresh)  != izero;
+    const i32v jumped   = (b & L_jumped)   != izero;
+    const i32v ultra    = (b & L_ultra)    != izero;
+    const i32v dashing  = (b & L_dashing)  != izero;
+
+    f32v vx_ = vload <f32v> (&vx[i]);
+    f32v vy_ = vload <f32v> (&vy[i]);
+    const i32v h = vload <i32v> (&held[i]);
+    const f32v m = __builtin_convertvector (((h & K_left) != izero) - ((h & K_right) != izero), f32v); // true is -1
+
+    // on_grounded
+    {
+      const i32v d = vload <i32v> (&n_dashes[i]);
+      vstore (&nn_dashes[i], refresh ? izero + 1 : d);
+    }
+
+    // do_jumping
+    vx_ = ultra  ? vx_ * P::ultra_boost    : vx_;
+    vy_ = jumped ? zero - P::jump_liftoff : vy_;
+
+    // do_movement
+    {
+      const f32v m_sign = signum (m);
+      const f32v v_sign = signum (vx_);
+      const f32v fric = grounded ? zero + P::fric_ground : zero + P::fric_air;
+      const f32v walk_max = zero + P::walk_max;
+
+      const f32v a2 = vx_ - v_sign * fric;
+      const f32v a  = (signum (a2) == v_sign ? a2 : zero) * (1 - P::walk_stopping);
+
+      const f32v b_ = m_sign * P::walk_accel;
+
+      const f32v c2 = vx_ + P::walk_accel * v_sign;
+      const f32v c  = c2 * v_sign > walk_max ? walk_max * v_sign : c2;
+
+      const f32v d2 = vx_ - v_sign * fric * P::walk_reduce;
+      const f32v d  = no_fric ? vx_ : d2 * v_sign < walk_max ? walk_max * v_sign : d2;
+
+      const f32v moved
+        = m == zero       ? a
+        : v_sign != m_sign ? b_
+        : vx_ * v_sign < walk_max ? c
+        : d;
+
+      vx_ = locked || dashing ? vx_ : moved;
+
+      const i32v f = vload <i32v> (&facing[i]);
+      vstore (&nfacing[i], !locked && !dashing && m != zero ? __builtin_convertvector (m, i32v) : f);
+    }
+
+    // do_gravity
+    {
+      const f32v g = jump ? (zero_g ? zero : zero + 0.5f) : one;
+      const f32v fall = vy_ + g;
+      const f32v capped = fall < P::gravity_max ? fall : zero + P::gravity_max;
+      vy_ = !grounded && !dashing && vy_ < P::gravity_max ? capped : vy_;
+    }
+
+    // apply_velocity, if nothing is in the way
+    {
+      const float scale = 0.009;
+      const f32v dx = vx_ * scale, dy = vy_ * scale;
+      const f32v to_x = vload <f32v> (&px[i]) + dx;
+      const f32v to_y = vload <f32v> (&py[i]) + dy;
+      vstore (&npx[i], to_x);
+      vstore (&npy[i], to_y);
+
+      // `Player::reach`
+      const f32v ax = dx < zero ? -dx : dx;
+      const f32v ay = dy < zero ? -dy : dy;
+
+      const V2 <float> size = to_float (P::size);
+      const V2 <float> r0 = to_float (grids[0].rect_pos), r1 = to_float (grids[0].rect_end);
+      const i32v still = vx_ == zero && vy_ == zero;
+      const i32v far   = ax / size.x > one || ay / size.y > one;
+      const i32v room_ = to_x >= r0.x && to_x + size.x <= r1.x
+                      && to_y >= r0.y && to_y + size.y <= r1.y;
+      vstore (&bits[i], b | (still & L_still) | (far & L_far) | (room_ & L_in_room));
+    }
+
+    vstore (&nvx[i], vx_);
+    vstore (&nvy[i], vy_);
+  }
+
+  // Whether lane `i` really did take the fast path, now that we know where
+  // the kernel wants to move it. Also takes care of the player sliding along
+  // a floor, wall or ceiling, as long as that stays inside the room.
+  bool fast (int i)
+  {
+    if (! (bits[i] & batch::L_fast))
+      return false;
+
+    const int32_t b = bits[i];
+
+    // apply_velocity: not moving at all, or moving without touching anything
+    if (b & batch::L_still)
+      return true;
+    if (b & batch::L_far)
+      return false;
+
+    ground[i] = 2;
+
+    const V2 <coord> to { npx[i], npy[i] };
+    if (b & batch::L_in_room)
+    {
+      if (! solid (grids[0], to, P::size))
+      {
+        ground[i] = ground_at (to);
+        return true;
+      }
+    }
+    else
+    {
+      if (! inside (to, P::size) || ! stays (to))
+        return false;
+      if (! solid (to, P::size))
+        return true;
+    }
+
+    return slide (i, b & batch::L_grounded);
+  }
+
+  // A lane going into a slide, or coming out of it
+  struct Motion
+  {
+    coord px, py, vx, vy;
+    int32_t xs, ys;
+  };
+
+  // The last slide each lane got through. A player pushing against a wall
+  // takes the same one tick after tick.
+  struct Slide
+  {
+    bool ok, grounded;
+    Motion from, to;
+    uint8_t ground; // `ground_at (to)`
+  };
+  std::vector <Slide> last_slide;
+
+  // The part of `apply_velocity` that deals with running into something,
+  // run on the lane's n* values.
+  bool slide (int i, bool grounded)
+  {
+    using std::abs;
+
+    // Compared bit for bit, -0 isn't 0 here
+    const Motion from { px[i], py[i], nvx[i], nvy[i], x_slide[i], y_slide[i] };
+    Slide & l = last_slide[i];
+    if (l.ok && l.grounded == grounded && memcmp (&l.from, &from, sizeof from) == 0)
+    {
+      npx[i] = l.to.px; npy[i] = l.to.py;
+      nvx[i] = l.to.vx; nvy[i] = l.to.vy;
+      x_slide[i] = l.to.xs;
+      y_slide[i] = l.to.ys;
+      ground[i]  = l.ground;
+      return true;
+    }
+
+    bool outside = false;
+    const auto hit = [&] (V2 <coord> p)
+    {
+      if (inside (p, P::size))
+        return solid (p, P::size);
+      outside = true;
+      return true;
+    };
+
+    V2 <coord> pos { px[i], py[i] };
+    const V2 <coord> to { npx[i], npy[i] };
+    coord & vx_ = nvx[i];
+    coord & vy_ = nvy[i];
+    int xs = x_slide[i], ys = y_slide[i];
+
+    // `moveX` and `moveY`
+    const auto move = [&] (coord & c, coord d)
+    {
+      sweep::move_axis (pos, &c == &pos.y, d, P::size, hit);
+    };
+
+    const float scale = 0.009;
+
+    if (vy_ == 0)
+    {
+      const float c
+        = abs (vx_) < P::corner_correction_fast_vel
+        ? P::corner_correction_slow
+        : P::corner_correction_fast
+        ;
+
+      if (const V2 <coord> p { to.x, to.y - c }; ! hit (p))
+      {
+        // landing on something would need `early_grounding`
+        if (! grounded) return false;
+        pos = p; move (pos.y, +c);
+      }
+      else if (const V2 <coord> p { to.x, to.y + c }; ! hit (p))
+        { pos = p; move (pos.y, -c); }
+      else
+      {
+        move (pos.x, vx_ * scale);
+        vx_ = 0;
+      }
+    }
+    else if (vx_ == 0)
+    {
+      const float c
+        = abs (vy_) < P::corner_correction_fast_vel
+       || vy_ > 0
+        ? P::corner_correction_slow
+        : P::corner_correction_fast
+        ;
+
+      if (const V2 <coord> p { to.x - c, to.y }; ! hit (p))
+        { pos = p; move (pos.x, +c); }
+      else if (const V2 <coord> p { to.x + c, to.y }; ! hit (p))
+        { pos = p; move (pos.x, -c); }
+      else
+      {
+        if (vy_ > 0 && ! grounded) return false;
+        move (pos.y, vy_ * scale);
+        vy_ = 0;
+      }
+    }
+    else
+    {
+      const V2 <coord> d { vx_ * scale, vy_ * scale };
+      if (pinned (0, pos, d))
+        sweep::move_xy (pos, d, P::size, [&] (V2 <coord> p) { return p.x != px[i]; });
+      else if (pinned (1, pos, d))
+        sweep::move_xy (pos, d, P::size, [&] (V2 <coord> p) { return p.y != py[i]; });
+      else
+        sweep::move_xy (pos, d, P::size, hit);
+
+      bool x_moved = pos.x != px[i], x_more = pos.x != to.x;
+      bool y_moved = pos.y != py[i], y_more = pos.y != to.y;
+
+      if (x_moved && x_more && ! hit ({to.x, pos.y}))
+        { pos.x = to.x; x_more = false; }
+      else if (y_moved && y_more && ! hit ({pos.x, to.y}))
+        { pos.y = to.y; y_more = false; }
+
+      const int grace = P::slide_grace;
+
+      if (x_moved)                        xs = 0;
+      else if (y_moved && xs < grace)     xs++;
+      else                              { vx_ = 0; xs = 0; }
+
+      if (y_moved)                        ys = 0;
+      else if (x_moved && ys < grace)     ys++;
+      else                              { vy_ = 0; ys = 0; }
+
+      if (y_moved && y_more && vy_ > 0 && ! grounded)
+        return false;
+    }
+
+    if (outside || ! stays (pos))
+      return false;
+
+    npx[i] = pos.x;
+    npy[i] = pos.y;
+    x_slide[i] = xs;
+    y_slide[i] = ys;
+    ground[i] = ground_at (pos);
+    l = { true, grounded, from, { pos.x, pos.y, vx_, vy_, xs, ys }, ground[i] };
+    return true;
+  }
+
+  // ---- collision
+
+  // The room and a few tiles around it, where the fast path can go. Only
+  // rooms up to 64 tiles wide that don't overlap any other room get one.
+  // The rooms next to it count too, since a player falling through the
+  // floor or walking out the side is in both for a few ticks. `step` takes
+  // all this again whenever `set_tile` has changed the level since.
+  bool enabled = false;
+  V2 <int> room_pos {}, room_size {};
+  V2 <int> area_pos {}, area_size {};
+  uint64_t revision = 0; // `Level::revision` when we took it
+
+  // One room's tiles, one bit per tile, one word per row, bit 0 being the
+  // area's first column. `grids[0]` is our room. Row `y + k * size.y` has
+  // rows `y` to `y + k` in one, for the few rows a player's box covers.
+  struct Grid
+  {
+    static constexpr int spans = 4;
+
+    int room;
+    V2 <int> pos, size;
+    V2 <coord> rect_pos, rect_size, rect_end; // the same, as coordinates
+    int off_y, shift; // see `tile_range`, and where bit 0 is
+    std::vector <uint64_t> rows;
+  };
+  std::vector <Grid> grids {};
+
+  void make_grid ()
+  {
+    revision = level.revision;
+    enabled  = false;
+    last_slide.assign (last_slide.size (), {});
+    ground.assign (ground.size (), 2);
+    asleep.assign (asleep.size (), false);
+
+    // The kernel only knows floats
+    if constexpr (! global::fixed_timestep || global::fixed_point)
+      return;
+
+    const auto & tm = level.tilemaps[room];
+    room_pos  = tm.pos;
+    room_size = tm.size;
+
+    if (room_size.x > 64)
+      return;
+
+    // Whatever `hit_test` might look at for a box in the area has to fit
+    // in a word, see `solid`
+    const int margin = std::clamp ((63 - room_size.x) / 2, 0, 2);
+    area_pos  = room_pos - margin;
+    area_size = room_size + margin * 2;
+
+    grids.clear ();
+    grids.push_back ({ room, room_pos, room_size, {}, {}, {}, 0, 0, {} });
+
+    for (int j = 0; j < (int) level.tilemaps.size (); j++)
+    {
+      const auto & o = level.tilemaps[j];
+      if (j == room)
+        continue;
+      if (rect_in_rect (o.pos, o.size, tm.pos, tm.size))
+        return;
+      if (rect_in_rect (o.pos, o.size, area_pos, area_size))
+        grids.push_back ({ j, o.pos, o.size, {}, {}, {}, 0, 0, {} });
+    }
+
+    for (Grid & g : grids)
+    {
+      const auto & o = level.tilemaps[g.room];
+      g.rect_pos  = { (coord) g.pos.x,  (coord) g.pos.y  };
+      g.rect_size = { (coord) g.size.x, (coord) g.size.y };
+      g.rect_end  = g.rect_pos + g.rect_size;
+      g.off_y = ! global::fixed_point && g.pos.y < 0 ? -1 : 0;
+      g.shift = g.pos.x - area_pos.x;
+      g.rows.assign (g.size.y * Grid::spans, 0);
+      for (int y = 0; y < g.size.y; y++)
+      for (int x = 0; x < 64; x++)
+      {
+        const int ox = area_pos.x + x - g.pos.x;
+        if (ox >= 0 && ox < g.size.x && o.tiles[ox + y * g.size.x].is_nonempty ())
+          g.rows[y] |= uint64_t (1) << x;
+      }
+      for (int k = 1; k < Grid::spans; k++)
+      for (int y = 0; y + k < g.size.y; y++)
+        g.rows[y + k * g.size.y] = g.rows[y + (k - 1) * g.size.y] | g.rows[y + k];
+    }
+
+    enabled = true;
+  }
+
+  // Whether a box is somewhere we have the tiles for
+  bool inside (V2 <coord> p, V2 <coord> s) const
+  {
+    return p.x >= area_pos.x && p.x + s.x <= area_pos.x + area_size.x
+        && p.y >= area_pos.y && p.y + s.y <= area_pos.y + area_size.y;
+  }
+
+  // Whether a player at `p` is still in our room as far as
+  // `World::get_current_screen` goes: in it, or in no room at all
+  bool stays (V2 <coord> p) const
+  {
+    const V2 <coord> c { p.x + P::size.x/2, p.y + P::size.y/2 };
+    for (const Grid & g : grids)
+      if (pt_in_rect (c, g.rect_pos, g.rect_size))
+        return &g == &grids[0];
+    return true;
+  }
+
+  // Whether `do_grounding` finds ground under a player at `p` who isn't
+  // dashing, or 2 if that's not all in our room
+  uint8_t ground_at (V2 <coord> p) const
+  {
+    const Grid & r = grids[0];
+    const float feet_h = 0.15;
+    const V2 <coord> feet { p.x, p.y + P::size.y };
+    if ( feet.x >= r.rect_pos.x && feet.x + P::size.x <= r.rect_end.x
+      && feet.y >= r.rect_pos.y && feet.y + feet_h <= r.rect_end.y
+       )
+      return solid (r, feet, { P::size.x, feet_h });
+    return 2;
+  }
+
+  // Same as `hit_test (level, p, s)` for a box that is `inside`, down to
+  // the rounding
+  bool solid (V2 <coord> p, V2 <coord> s) const
+  {
+    const Grid & r = grids[0];
+    if ( p.x >= r.rect_pos.x && p.x + s.x <= r.rect_end.x
+      && p.y >= r.rect_pos.y && p.y + s.y <= r.rect_end.y
+       )
+      return solid (r, p, s);
+
+    for (const Grid & g : grids)
+      if (rect_in_rect (p, s, g.rect_pos, g.rect_size) && solid (g, p, s))
+        return true;
+    return false;
+  }
+
+  // `tile_range` and `TileMapEx::any_solid` on one grid
+  bool solid (const Grid & g, V2 <coord> p, V2 <coord> s) const
+  {
+    return solid (g, columns (g, p.x, s.x), p.y, s.y);
+  }
+
+  // The bits of the columns a box from `x` to `x + w` covers in `g`
+  uint64_t columns (const Grid & g, coord x, coord w) const
+  {
+    const int x0 = std::max <int> (first_tile (x), g.pos.x) - g.pos.x;
+    const int x1 = std::min <int> (last_tile (x, w), g.pos.x + g.size.x) - g.pos.x;
+
+    const int xa = std::max (x0, 0);
+    const int xb = std::min (x1, g.size.x - 1);
+    if (xa > xb) return 0;
+
+    return (~uint64_t (0) >> (63 - (xb - xa))) << (xa + g.shift);
+  }
+
+  // The first and last of `g.rows` a box from `y` to `y + h` covers
+  V2 <int> rows (const Grid & g, coord y, coord h) const
+  {
+    const int y0 = std::max <int> (first_tile (y), g.pos.y) - g.pos.y;
+    const int y1 = std::min <int> (last_tile (y, h), g.pos.y + g.size.y) - g.pos.y;
+    return { std::max (y0 + g.off_y, 0), std::min (y1 + g.off_y, g.size.y - 1) };
+  }
+
+  // Whether a player at `p` moving by `d` is held by a wall on one `axis`
+  // the whole way, while nothing is in the way on the other one. The wall
+  // has to be solid all along, which is what walls usually are. Then
+  // `move_xy` can't move the player on that axis at all, and anything it
+  // asks `hit` about is solid exactly when it's off the player's line.
+  bool pinned (int axis, V2 <coord> p, V2 <coord> d) const
+  {
+    const Grid & r = grids[0];
+    const V2 <coord> to = p + d;
+    const V2 <coord> lo { std::min (p.x, to.x), std::min (p.y, to.y) };
+    const V2 <coord> hi { std::max (p.x, to.x), std::max (p.y, to.y) };
+
+    // One ulp closer to the wall
+    V2 <coord> n = p;
+    (axis ? n.y : n.x) = sweep::next (axis ? p.y : p.x, axis ? d.y : d.x);
+
+    for (const V2 <coord> q : { lo, hi, n })
+      if ( q.x < r.rect_pos.x || q.x + P::size.x > r.rect_end.x
+        || q.y < r.rect_pos.y || q.y + P::size.y > r.rect_end.y
+         )
+        return false;
+
+    if (axis == 0)
+    {
+      // a column next to us, solid on every row we pass
+      const uint64_t at   = columns (r, p.x, P::size.x);
+      const uint64_t wall = columns (r, n.x, P::size.x) & ~at;
+      if (! wall)
+        return false;
+
+      for (int y = rows (r, lo.y, P::size.y).x; y <= rows (r, hi.y, P::size.y).y; y++)
+        if ((r.rows[y] & at) || (r.rows[y] & wall) != wall)
+          return false;
+      return true;
+    }
+    else
+    {
+      // a row next to us, solid on every column we pass
+      const uint64_t span = columns (r, lo.x, P::size.x) | columns (r, hi.x, P::size.x);
+      const V2 <int> at = rows (r, p.y, P::size.y), next = rows (r, n.y, P::size.y);
+      const int w0 = d.y > 0 ? at.y + 1 : next.x;
+      const int w1 = d.y > 0 ? next.y   : at.x - 1;
+      if (w0 > w1)
+        return false;
+
+      for (int y = at.x; y <= at.y; y++)
+        if (r.rows[y] & span)
+          return false;
+      for (int y = w0; y <= w1; y++)
+        if ((r.rows[y] & span) != span)
+          return false;
+      return true;
+    }
+  }
+
+  // ... and whether any of them is solid from `y` to `y + h`
+  bool solid (const Grid & g, uint64_t mask, coord y, coord h) const
+  {
+    const V2 <int> ys = rows (g, y, h);
+    const int ya = ys.x, yb = ys.y;
+    if (! mask || ya > yb) return false;
+
+    const int k = yb - ya;
+    if (k < Grid::spans)
+      return g.rows[k * g.size.y + ya] & mask;
+
+    uint64_t any = 0;
+    for (int y = ya; y <= yb; y++)
+      any |= g.rows[y];
+    return any & mask;
+  }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "V2.h"
+#include "fixed.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Which of a bunch of moving boxes overlap each other, so that finding
+// everything the player or an entity touches doesn't mean comparing it
+// against everything else.
+//
+// Sweep and prune on x: the boxes are kept sorted by their left edge, and
+// a sweep from left to right only compares a box against the ones whose x
+// range is still open when it starts. Things don't move far in a tick, so
+// the order from the last tick is nearly right and an insertion sort puts
+// it back in order in about linear time.
+//
+// Ties are broken by id, so the order (and with it the order of `pairs`)
+// only depends on the boxes and not on how they got there; a rewound world
+// gets its callbacks in the same order as the first time around.
+//
+struct Broadphase
+{
+  struct Box
+  {
+    coord x0, y0, x1, y1;
+  };
+
+  struct Pair
+  {
+    uint32_t a, b; // a < b
+  };
+
+  // Indexed by id. Boxes with no area never overlap anything.
+  std::vector <Box>  boxes {};
+  std::vector <Pair> pairs {};
+
+  void clear ()
+  {
+    boxes.clear ();
+  }
+  void add (V2 <coord> pos, V2 <coord> size)
+  {
+    boxes.push_back ({ pos.x, pos.y, pos.x + size.x, pos.y + size.y });
+  }
+
+  // Fills `pairs` with every two boxes that overlap, edges that only touch
+  // don't count
+  void find ()
+  {
+    pairs.clear ();
+
+    if (order.size () != boxes.size ())
+    {
+      order.resize (boxes.size ());
+      for (size_t i = 0; i < order.size (); i++)
+        order[i] = i;
+      std::sort (order.begin (), order.end (), [&] (uint32_t a, uint32_t b) { return before (a, b); });
+    }
+    else
+    {
+      for (size_t i = 1; i < order.size (); i++)
+      {
+        const uint32_t id = order[i];
+        size_t j = i;
+        for (; j > 0 && before (id, order[j-1]); j--)
+          order[j] = order[j-1];
+        order[j] = id;
+      }
+    }
+
+    active.clear ();
+    for (const uint32_t id : order)
+    {
+      const Box & b = boxes[id];
+      if (! (b.x0 < b.x1 && b.y0 < b.y1)) continue;
+
+      // Drop the boxes that end before this one starts
+      size_t n = 0;
+      for (const uint32_t o : active)
+        if (b.x0 < boxes[o].x1)
+          active[n++] = o;
+      active.resize (n);
+
+      for (const uint32_t o : active)
+      {
+        const Box & a = boxes[o];
+        if (a.y0 < b.y1 && b.y0 < a.y1)
+          pairs.push_back ({ std::min (o, id), std::max (o, id) });
+      }
+      active.push_back (id);
+    }
+  }
+
+private:
+  std::vector <uint32_t> order  {}; // ids by left edge, kept between calls
+  std::vector <uint32_t> active {};
+
+  bool before (uint32_t a, uint32_t b) const
+  {
+    const coord xa = boxes[a].x0, xb = boxes[b].x0;
+    return xa < xb || (xa == xb && a < b);
+  }
+};
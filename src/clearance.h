@@ -0,0 +1,79 @@
+#pragma once
+
+#include "V2.h"
+#include "tilemap.h"
+#include "fixed.h"
+#include <algorithm>
+
+struct Level;
+
+// ----
+
+struct Rect
+{
+  V2 <coord> pos, size;
+};
+
+// The tiles of `tm` that `hit_test` looks at for the box `p`, `s`: relative
+// to the room, inclusive, and clipped to it.
+TileRange tile_range (const TileMapEx & tm, V2 <coord> p, V2 <coord> s)
+{
+  const int x0 = std::max<int>(first_tile (p.x), tm.pos.x) - tm.pos.x;
+  const int y0 = std::max<int>(first_tile (p.y), tm.pos.y) - tm.pos.y;
+  const int x1 = std::min<int>(last_tile (p.x, s.x), tm.pos.x + tm.size.x) - tm.pos.x;
+  const int y1 = std::min<int>(last_tile (p.y, s.y), tm.pos.y + tm.size.y) - tm.pos.y;
+
+  // Truncating negative coordinates puts them a tile too far down, see
+  // `first_tile`. Fixed point doesn't truncate.
+  const int off_y = ! global::fixed_point && tm.pos.y < 0 ? -1 : 0;
+
+  return TileRange
+    { .p0 = { std::max (x0, 0),         std::max (y0 + off_y, 0) }
+    , .p1 = { std::min (x1, tm.size.x - 1), std::min (y1 + off_y, tm.size.y - 1) }
+    };
+}
+
+// ----
+
+// What is right around the player, so that the collision checks it makes
+// every tick (moving a little, looking for walls beside it and floor under
+// it) can be answered from the runs in `TileMapEx` instead of finding the
+// room and scanning its tiles every time.
+//
+// For the tiles the box is on, it keeps the shortest run from the box's
+// left and right edge along its rows, and from its top and bottom edge
+// along its columns. That settles any check on a box in the same room that
+// covers the same rows or the same columns: sliding sideways, falling, and
+// the thin boxes beside and below the player. Anything else is left to
+// `hit_test`.
+//
+// It only depends on which tiles the box is on, so it stays good while the
+// player moves around within them, which is most ticks.
+//
+struct Clearance
+{
+  // Gets ready for checks around the box `pos`, `size`
+  void update (const Level & level, V2 <coord> pos, V2 <coord> size);
+
+  // What `hit_test (level, p, s)` would say: 1 or 0, or -1 if we can't tell
+  int hit (V2 <coord> p, V2 <coord> s) const;
+
+private:
+  const Level * level = nullptr;
+  uint64_t revision = 0;  // `Level::revision` when we looked
+  V2 <int> k0 {}, k1 {};  // the first and last tiles of the box
+
+  const TileMapEx * tm = nullptr; // null when the runs don't tell us anything
+  TileRange box {};
+  int left = 0, right = 0, up = 0, down = 0;
+
+  // Whether there's anything in tiles `a` to `b` of the rows (or columns)
+  // the box covers from `lo` to `hi`
+  static int along (int a, int b, int lo, int hi, int back, int fwd)
+  {
+    if (back < TileMapEx::open && a <= lo - back && lo - back <= b) return 1;
+    if (fwd  < TileMapEx::open && a <= hi + fwd  && hi + fwd  <= b) return 1;
+    if (lo - back < a && b < hi + fwd) return 0;
+    return -1;
+  }
+};
@@ -1,33 +1,49 @@
 #pragma once
 
 #include "V2.h"
-#include "shader.h"
 #include "input.h"
+#include "fixed.h"
 #include <fmt/printf.h>
-#include <glm/ext/matrix_transform.hpp>
-#include <glm/glm.hpp>
 #include <vector>
-#include <stack>
-
-// ----
+#include <cstdint>
+#include <cstring>
 
-static Shader shader, simple_shader;
+// The headless simulation (see sim.cpp) is built with HEADLESS defined,
+// which strips out everything that needs OpenGL.
+#ifndef HEADLESS
+#include <glm/glm.hpp>
+#endif
 
 // ----
 
+struct World;
+
 struct Entity
 {
-  virtual void tick ()
+  // The entity's box, for overlap checks (see broadphase.h). Entities with
+  // no size don't overlap anything.
+  V2 <coord> pos {}, size {};
+
+  virtual void tick (World &)
   {
   }
 
+  // Called once per tick, after everything has moved, for each entity and
+  // for the player if their boxes overlap ours
+  virtual void overlap (World &, Entity &)
+  {
+  }
+  virtual void touch_player (World &)
+  {
+  }
+
+#ifndef HEADLESS
   virtual void render (glm::mat4 model)
   {
   }
+#endif
 };
 
-static std::vector<Entity *> entities;
-
 // ----
 
 struct Particle
@@ -44,17 +60,17 @@ struct Particle
   float amul = 1.0;
   float apow = 5.0;
 
-  bool tick ()
+  bool tick (const Clock & c)
   {
-    const int age = global::ticks_elapsed - birth;
+    const int age = c.ticks_elapsed - birth;
     if (age > ttl)
       return false;
 
     const float a = (float) age / ttl;
 
-    pos += vel * global::dt;
-    vel += grav * 100 * global::dt;
-    vel -= vel * fric * global::dt;
+    pos += vel * c.dt;
+    vel += grav * 100 * c.dt;
+    vel -= vel * fric * c.dt;
 
     alpha = (1.0 - std::pow(a, apow)) * amul;
     if (animate_size)
@@ -64,72 +80,107 @@ struct Particle
   }
 };
 
-static int roll (int size)
-{
-  return rand () % size;
-}
-static float rollf ()
+// Each world rolls its own dice, rather than sharing `rand ()`, so that
+// worlds on different threads neither race nor disturb each other.
+struct Rng
 {
-  return (float) (rand ()) / RAND_MAX;
-}
-static float rollf (float lo)
-{
-  return 1.0 - lo * rollf ();
-}
-static int roll_sign ()
-{
-  const int rng = rand ();
-  return (rng & 2) - 1;
-}
+  uint64_t state = 0x9e3779b97f4a7c15;
+
+  // xorshift64*
+  uint32_t next ()
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (state * 0x2545f4914f6cdd1d) >> 32;
+  }
+
+  int roll (int size)
+  {
+    return next () % size;
+  }
+  float rollf ()
+  {
+    return (float) next () / UINT32_MAX;
+  }
+  float rollf (float lo)
+  {
+    return 1.0 - lo * rollf ();
+  }
+  int roll_sign ()
+  {
+    const int rng = next ();
+    return (rng & 2) - 1;
+  }
+};
 
-struct Particles : Entity
+// A fixed number of particles stored inline, so that all of them can be
+// copied around as one flat block (see snapshot.h). Particles are only
+// for show, so when we run out of room new ones are simply dropped.
+struct ParticleBuf
 {
-  std::stack <Particle> ps {};
+  static constexpr int capacity = 512;
+
+  int n = 0;
+  Particle ps [capacity];
 
-  void tick () override
+  void push (const Particle & p)
   {
-    std::stack <Particle> next;
-    while (! ps.empty ())
-    {
-      if (ps.top().tick ())
-        next.push (ps.top ());
-      ps.pop ();
-    }
-    ps = next;
+    if (n < capacity)
+      ps[n++] = p;
   }
-  void render (glm::mat4 model) override
+  void clear ()
   {
-    simple_shader.use ();
+    n = 0;
+  }
 
-    std::stack <Particle> next;
-    while (! ps.empty ())
+  // Copies only the live particles
+  void copy_from (const ParticleBuf & that)
+  {
+    n = that.n;
+    memcpy (ps, that.ps, n * sizeof (Particle));
+  }
+
+  // Moves every particle along, dropping the ones that died
+  void tick (const Clock & c)
+  {
+    int j = 0;
+    for (int i = 0; i < n; i++)
     {
-      const auto p = ps.top ();
-      ps.pop ();
-      {
-        const auto model_ = glm::translate(model, {p.pos.x - p.size.w/2, p.pos.y - p.size.h/2, 0.0});
-        simple_shader.setMat4("model", model_);
-        simple_shader.setVec2("size", p.size.w, p.size.h);
-        simple_shader.setVec4 ("color", p.r, p.g, p.b, p.alpha);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-      }
-      next.push (p);
+      if (ps[i].tick (c))
+        ps[j++] = ps[i];
     }
-    ps = next;
-
+    n = j;
   }
 
+  Particle * begin () { return ps; }
+  Particle * end   () { return ps + n; }
 
-  void spawn ( V2 <float> pos, V2 <float> off, float angle, float spread, float speed_min, float speed
+  const Particle * begin () const { return ps; }
+  const Particle * end   () const { return ps + n; }
+};
+
+struct Particles
+{
+  ParticleBuf ps {};
+  Rng rng {};
+
+  void tick (const Clock & c)
+  {
+    ps.tick (c);
+  }
+
+  void spawn ( const Clock & c
+             , V2 <float> pos, V2 <float> off, float angle, float spread, float speed_min, float speed
              , float grav, float r, float g, float b
              , float size_, int ttl_, float fric
              )
   {
-    const int ttl = 20 + roll (ttl_);
-    const float size = size_ * rollf (0.7);
+    const int ttl = 20 + rng.roll (ttl_);
+    const float size = size_ * rng.rollf (0.7);
 
-    const float speed_ = speed_min + speed * rollf (0.8);
-    const float angle_ = (angle + spread * (rollf () - 0.5)) * 3.141592653589793238 * 2.0;
+    const float speed_ = speed_min + speed * rng.rollf (0.8);
+    const float angle_ = (angle + spread * (rng.rollf () - 0.5)) * 3.141592653589793238 * 2.0;
     V2 <float> v = V2 <float> { std::sin(angle_), std::cos(angle_) };
 
     ps.push (Particle
@@ -137,8 +188,8 @@ struct Particles : Entity
       , .vel = v * speed_
       , .grav = { 0.0, grav }
       , .size = size
-      , .birth = global::ticks_elapsed
-      , .ttl = (int) global::scaled_ticks (ttl)
+      , .birth = c.ticks_elapsed
+      , .ttl = (int) c.scaled_ticks (ttl)
       , .start_size = size
       , .r = r, .g = g, .b = b
       , .fric = fric
@@ -147,15 +198,3 @@ struct Particles : Entity
   }
 
 };
-
-// ----
-
-static Particles * particles = new Particles {};
-
-static void init_entities ()
-{
-  entities.push_back
-    ( particles
-    );
-}
-
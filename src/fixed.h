@@ -0,0 +1,119 @@
+#pragma once
+
+#include "V2.h"
+#include "input.h"
+#include <cmath>
+#include <compare>
+#include <cstdint>
+#include <type_traits>
+#include <fmt/core.h>
+
+// A number with `frac_bits` binary places in an int32: 1/65536 of a tile,
+// and tiles from -32768 to 32767.
+//
+// Float trajectories depend on the compiler keeping every rounding step the
+// same, which it doesn't have to (it may fuse a multiply and an add, for
+// one). And collision turns coordinates into tiles with `(int)`, which
+// rounds towards zero, one tile off for negative coordinates; that's what
+// the `off_y` in `tile_range` makes up for, mostly. In FIXED_POINT builds
+// the player's position and velocity are `Fixed` instead: moving is integer
+// arithmetic, and which tile a coordinate is in is a shift.
+//
+// Constants stay floats and get rounded to the nearest step when they meet
+// a `Fixed`, which is exact and the same everywhere. Going back to a float
+// (for drawing, particles, ...) takes a cast.
+//
+struct Fixed
+{
+  static constexpr int     frac_bits = 16;
+  static constexpr int32_t one       = 1 << frac_bits;
+
+  int32_t raw;
+
+  constexpr Fixed () = default;
+  constexpr Fixed (int    v) : raw { v * one } {}
+  constexpr Fixed (double v) : raw { round (v * one) } {}
+
+  static constexpr Fixed from_raw (int32_t r)
+  {
+    Fixed f;
+    f.raw = r;
+    return f;
+  }
+
+  explicit constexpr operator float  () const { return (float)  raw / one; }
+  explicit constexpr operator double () const { return (double) raw / one; }
+
+  constexpr Fixed operator - () const { return from_raw (-raw); }
+
+  // Products round to the nearest step, quotients towards zero
+  friend constexpr Fixed operator + (Fixed a, Fixed b) { return from_raw (a.raw + b.raw); }
+  friend constexpr Fixed operator - (Fixed a, Fixed b) { return from_raw (a.raw - b.raw); }
+  friend constexpr Fixed operator * (Fixed a, Fixed b)
+  {
+    return from_raw (((int64_t) a.raw * b.raw + one / 2) >> frac_bits);
+  }
+  friend constexpr Fixed operator / (Fixed a, Fixed b)
+  {
+    return from_raw (((int64_t) a.raw << frac_bits) / b.raw);
+  }
+
+  constexpr Fixed & operator += (Fixed b) { return *this = *this + b; }
+  constexpr Fixed & operator -= (Fixed b) { return *this = *this - b; }
+  constexpr Fixed & operator *= (Fixed b) { return *this = *this * b; }
+  constexpr Fixed & operator /= (Fixed b) { return *this = *this / b; }
+
+  friend constexpr bool operator ==  (Fixed a, Fixed b) = default;
+  friend constexpr auto operator <=> (Fixed a, Fixed b) = default;
+
+private:
+  static constexpr int32_t round (double v)
+  {
+    return v < 0 ? -(int32_t) (-v + 0.5) : (int32_t) (v + 0.5);
+  }
+};
+
+static_assert (std::is_trivially_copyable_v <Fixed>);
+
+constexpr Fixed floor (Fixed v) { return Fixed::from_raw (v.raw & ~(Fixed::one - 1)); }
+constexpr Fixed ceil  (Fixed v) { return -floor (-v); }
+constexpr Fixed abs   (Fixed v) { return v.raw < 0 ? -v : v; }
+
+// What the player's position and velocity are kept in
+using coord = std::conditional_t <global::fixed_point, Fixed, float>;
+
+template <class T>
+V2 <float> to_float (V2 <T> v)
+{
+  return { (float) v.x, (float) v.y };
+}
+
+// ----
+
+// Which tiles a box from `p` to `p + s` covers on one axis, from
+// `first_tile` to `last_tile` inclusive, before it's clipped to a room.
+//
+// Floats round towards zero and count the far edge in: a box that ends
+// exactly on a tile boundary covers the tile after it. Fixed point rounds
+// down and leaves the far edge out, so boxes are [p, p + s) like the tiles.
+//
+int first_tile (float p)          { return (int) p; }
+int last_tile  (float p, float s) { return (int) (p + s); }
+int first_tile (Fixed p)          { return p.raw >> Fixed::frac_bits; }
+int last_tile  (Fixed p, Fixed s) { return (p.raw + s.raw - 1) >> Fixed::frac_bits; }
+
+// The tile `v` is in
+int tile_floor (float v) { return (int) std::floor (v); }
+int tile_floor (Fixed v) { return v.raw >> Fixed::frac_bits; }
+
+// ----
+
+template <>
+struct fmt::formatter <Fixed> : fmt::formatter <double>
+{
+  template <class Ctx>
+  auto format (Fixed v, Ctx & ctx) const
+  {
+    return fmt::formatter <double>::format ((double) v, ctx);
+  }
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "V2.h"
+#include "input.h"
+#include "fixed.h"
+#include <bit>
+#include <cstdint>
+
+// A running 64-bit hash of the simulation state. `World::tick` mixes the
+// state into it after every tick, so two worlds that were fed the same
+// inputs have the same hash for as long as they behave the same, and
+// different hashes from the first tick where they don't.
+//
+// Recordings store it every few ticks (see replay.h), which turns "the
+// replay ended up somewhere else" into "the replay went wrong on frame N".
+//
+// This is meant to catch desyncs, not to be hard to collide, and it runs on
+// every tick, so it has to be cheap. The state is four independent lanes,
+// and each `add` packs its values into 64-bit words and deals them out over
+// the lanes, which keeps the chain of dependent multiplies short. The lanes
+// are only folded into one number by `value`, when a recording asks for it.
+//
+struct StateHash
+{
+  uint64_t lanes [4] = { 0, 1, 2, 3 };
+
+  static constexpr uint64_t mix (uint64_t a, uint64_t v)
+  {
+    return std::rotl ((a ^ v) * 0x9e3779b97f4a7c15, 29);
+  }
+
+  static constexpr uint64_t word (uint64_t v) { return v; }
+  static constexpr uint64_t word (int64_t  v) { return v; }
+  static constexpr uint64_t word (int      v) { return (uint32_t) v; }
+  static constexpr uint64_t word (bool     v) { return v; }
+  static constexpr uint64_t word (float    v) { return std::bit_cast <uint32_t> (v); }
+  static constexpr uint64_t word (double   v) { return std::bit_cast <uint64_t> (v); }
+  static constexpr uint64_t word (Fixed    v) { return (uint32_t) v.raw; }
+
+  template <class T>
+  static constexpr uint64_t word (V2 <T> v)
+  {
+    return word (v.x) | word (v.y) << 32;
+  }
+
+  template <tick_t N> static constexpr uint64_t word (const Timer     <N> & t) { return t.deadline; }
+  template <tick_t N> static constexpr uint64_t word (const Sec_Timer <N> & t) { return word (t.deadline); }
+
+  template <class... T>
+  void add (const T & ... vs)
+  {
+    const uint64_t ws [] = { word (vs)... };
+    for (size_t i = 0; i < sizeof... (T); i++)
+      lanes[i % 4] = mix (lanes[i % 4], ws[i]);
+  }
+
+  uint64_t value () const
+  {
+    return mix (mix (lanes[0], lanes[1]), mix (lanes[2], lanes[3]));
+  }
+
+  bool operator == (const StateHash &) const = default;
+};
@@ -1,13 +1,22 @@
 #pragma once
 
-#include <GLFW/glfw3.h>
 #include "V2.h"
+#include <cmath>
 #include <iostream>
-#include <map>
 #include <fmt/printf.h>
 
 // -----
 
+// Key actions as passed to `KeyMap::put`. These have the same values as
+// GLFW_RELEASE/GLFW_PRESS/GLFW_REPEAT so that `key_callback` can forward
+// GLFW events as-is, without the simulation having to depend on GLFW.
+constexpr int
+  key_release = 0,
+  key_press   = 1,
+  key_repeat  = 2;
+
+// -----
+
 using tick_t = size_t;
 
 constexpr tick_t
@@ -17,61 +26,108 @@ using secs = double;
 
 namespace global
 {
-  static tick_t  ticks_elapsed = 0;
-  static uint8_t ticks_to_skip = 0;
+  // In fixed step mode every tick lasts exactly `intended_tick_time`, no matter
+  // how long it actually took, and timers count whole ticks. The same inputs
+  // then always produce the same trajectory, on any machine and under any load.
+  //
+  // Build with VARIABLE_TIMESTEP to instead scale the physics by the measured
+  // tick time, which is how the game used to work.
+  //
+#ifdef VARIABLE_TIMESTEP
+  constexpr bool fixed_timestep = false;
+#else
+  constexpr bool fixed_timestep = true;
+#endif
+
+  // Build with FIXED_POINT to keep the player's position and velocity, and
+  // everything collision does with them, in fixed point (see fixed.h). The
+  // trajectories are then plain integer arithmetic, and come out the same
+  // whatever the compiler or optimization level. They are not the same as
+  // the float ones though, so recordings don't carry over between the two.
+  //
+#ifdef FIXED_POINT
+  constexpr bool fixed_point = true;
+#else
+  constexpr bool fixed_point = false;
+#endif
+
+  const tick_t intended_ticks_per_sec = 144;
+  /*const tick_t intended_ticks_per_sec = 80;*/
+  const secs intended_tick_time = 1.0 / intended_ticks_per_sec;
+}
+
+// Game time, and whether the game is frozen. Each `World` has its own.
+struct Clock
+{
+  tick_t  ticks_elapsed = 0;
+  tick_t  frames_elapsed = 0; // like `ticks_elapsed`, but also counts frozen ticks
+  uint8_t ticks_to_skip = 0;
+
+  secs dt = 0;
+  secs time = 0;
+  secs time_frozen = 0;
+
+  int is_frozen = false;
 
-  static secs dt = 0;
-  static secs time = 0;
-  static secs time_frozen = 0;
+  secs end_of_freeze_time = 0;
+  secs start_of_freeze_time = 0;
 
-  static secs time_elapsed ()
+  secs time_elapsed () const
   {
     return time - time_frozen;
   }
 
-  static secs tick_time ()
+  secs tick_time () const
   {
     return time_elapsed () / ticks_elapsed;
   }
-  static secs ticks_per_sec ()
+  secs ticks_per_sec () const
   {
+    if constexpr (global::fixed_timestep)
+      return global::intended_ticks_per_sec;
     return 1.0 / tick_time ();
   }
 
-  const tick_t intended_ticks_per_sec = 144;
-  /*const tick_t intended_ticks_per_sec = 80;*/
-  const secs intended_tick_time = 1.0 / intended_ticks_per_sec;
-
-  static secs tick_mult ()
+  secs tick_mult () const
   {
-    return ticks_per_sec () / intended_ticks_per_sec;
+    if constexpr (global::fixed_timestep)
+      return 1.0;
+    return ticks_per_sec () / global::intended_ticks_per_sec;
   }
-  static secs ticks_to_secs (tick_t t)
+  secs ticks_to_secs (tick_t t) const
   {
+    if constexpr (global::fixed_timestep)
+      return t * global::intended_tick_time;
     const secs s = tick_time ();
     const secs actual = 1.0 / s;
-    return t * s * (actual / intended_ticks_per_sec);
+    return t * s * (actual / global::intended_ticks_per_sec);
   }
 
-  static tick_t scaled_ticks (tick_t t)
+  tick_t scaled_ticks (tick_t t) const
   {
-    return std::round (((secs) t) * global::tick_mult ());
+    if constexpr (global::fixed_timestep)
+      return t;
+    return std::round (((secs) t) * tick_mult ());
   }
 
+  // How much to scale per-tick physics by; exactly 1 in fixed step mode
+  secs step_scale () const
+  {
+    if constexpr (global::fixed_timestep)
+      return 1.0;
+    return global::intended_ticks_per_sec * dt;
+  }
 
-  static int is_frozen = false;
-
-  static secs end_of_freeze_time = 0;
-  static secs start_of_freeze_time = 0;
 
-  // The actual freezing is performed in main
-  static void freeze_time (tick_t duration)
+  // The actual freezing is performed by whoever drives the clock,
+  // by not ticking the world while `is_frozen` is set.
+  void freeze_time (tick_t duration)
   {
     is_frozen = 1;
     start_of_freeze_time = time;
     ticks_to_skip += duration;
   }
-  static void freeze_time_seconds (double duration)
+  void freeze_time_seconds (double duration)
   {
     is_frozen = 2;
     start_of_freeze_time = time;
@@ -79,10 +135,11 @@ namespace global
   }
 
 
-  static void tick_time (double _time)
+  void tick_time (double _time)
   {
-    dt = _time - time;
+    dt = global::fixed_timestep ? global::intended_tick_time : _time - time;
     time = _time;
+    frames_elapsed++;
 
     if (is_frozen == 0)
     {
@@ -107,36 +164,42 @@ namespace global
       }
     }
   }
-}
+
+  // Advances the clock by exactly one tick, for the fixed step loop
+  void step ()
+  {
+    tick_time ((frames_elapsed + 1) * global::intended_tick_time);
+  }
+};
 
 template <tick_t framesT = 0>
 struct Timer
 {
   static constexpr tick_t frames = framesT;
-  tick_t deadline;
+  tick_t deadline = tick_t_never;
 
-  void start_exact (tick_t frames = framesT)
+  void start_exact (const Clock & c, tick_t frames = framesT)
   {
-    deadline = global::ticks_elapsed + frames;
+    deadline = c.ticks_elapsed + frames;
   }
-  void start (tick_t frames = framesT)
+  void start (const Clock & c, tick_t frames = framesT)
   {
-    const tick_t t = global::scaled_ticks (frames);
+    const tick_t t = c.scaled_ticks (frames);
     // fmt::print("time given: {}\n", t);
-    start_exact (t);
+    start_exact (c, t);
   }
   void stop ()
   {
     deadline = tick_t_never;
   }
 
-  bool alive ()
+  bool alive (const Clock & c) const
   {
-    return global::ticks_elapsed <= deadline;
+    return c.ticks_elapsed <= deadline;
   }
-  bool dead ()
+  bool dead (const Clock & c) const
   {
-    return global::ticks_elapsed > deadline;
+    return c.ticks_elapsed > deadline;
   }
 };
 
@@ -146,30 +209,45 @@ struct Sec_Timer
   static constexpr tick_t frames = framesT;
   secs deadline = -1;
 
-  void start_secs (secs s)
+  // The clock the deadline is measured on. In fixed step mode a second
+  // is always the same number of ticks, so we just count whole ticks.
+  static secs now (const Clock & c)
   {
-    deadline = global::time_elapsed () + s;
+    if constexpr (global::fixed_timestep)
+      return c.ticks_elapsed;
+    return c.time_elapsed ();
   }
-  void start_ms (secs ms)
+
+  void start_secs (const Clock & c, secs s)
   {
-    start_secs (ms / 1000);
+    if constexpr (global::fixed_timestep)
+      deadline = now (c) + std::round (s * global::intended_ticks_per_sec);
+    else
+      deadline = now (c) + s;
   }
-  void start (tick_t frames = framesT)
+  void start_ms (const Clock & c, secs ms)
   {
-    start_secs (global::intended_tick_time * frames);
+    start_secs (c, ms / 1000);
+  }
+  void start (const Clock & c, tick_t frames = framesT)
+  {
+    if constexpr (global::fixed_timestep)
+      deadline = now (c) + frames;
+    else
+      start_secs (c, global::intended_tick_time * frames);
   }
   void stop ()
   {
     deadline = -1;
   }
 
-  bool alive ()
+  bool alive (const Clock & c) const
   {
-    return deadline > 0 && global::time_elapsed() <= deadline;
+    return deadline > 0 && now (c) <= deadline;
   }
-  bool dead ()
+  bool dead (const Clock & c) const
   {
-    return deadline < 0 || global::time_elapsed() > deadline;
+    return deadline < 0 || now (c) > deadline;
   }
 };
 
@@ -187,40 +265,43 @@ struct KeyMapEntry
   }
 };
 
+// Indexed directly by key code, so that the whole keymap is one flat block
+// of memory that can be copied around (see snapshot.h).
+//
+// GLFW key codes go up to GLFW_KEY_LAST, which is 348. Anything outside
+// of that range (GLFW_KEY_UNKNOWN) is ignored.
+//
+constexpr int key_count = 349;
+
 struct KeyMap
 {
-  std::map<int, KeyMapEntry> m {};
+  KeyMapEntry m [key_count] {};
 
-  void put (tick_t time, int key, int scancode, int action, int mods)
+  void put (tick_t time, int key, int, int action, int mods)
   {
+    if (key < 0 || key >= key_count) return;
     if (mods != 0) return;
-    if (action != GLFW_PRESS && action != GLFW_RELEASE) return;
+    if (action != key_press && action != key_release) return;
 
     KeyMapEntry newE
-      { .state = action == GLFW_PRESS
+      { .state = action == key_press
       , .time  = time
       };
 
-    if (auto search = m.find (key); search == m.end ())
-      m.insert_or_assign (key, newE);
-    else
-    if (auto & oldE = search->second; oldE.state ^ newE.state)
+    if (auto & oldE = m [key]; oldE.state ^ newE.state)
       oldE = newE;
     else
       return;
   }
 
-  KeyMapEntry & get (int key)
+  const KeyMapEntry & get (int key) const
   {
+    static constexpr KeyMapEntry nil = KeyMapEntry::nil ();
+    if (key < 0 || key >= key_count) return nil;
     return m [key];
   }
 };
 
-namespace global
-{
-  static KeyMap keymap {};
-}
-
 // ----
 
 struct Key
@@ -230,27 +311,27 @@ struct Key
 
   const int operator () () const { return val; }
 
-  KeyMapEntry & entry () const
+  const KeyMapEntry & entry (const KeyMap & km) const
   {
-    return global::keymap.get (val);
+    return km.get (val);
   }
 
-  bool pressed () const
+  bool pressed (const KeyMap & km) const
   {
-    return entry () . state;
+    return entry (km) . state;
   }
 
-  tick_t time () const
+  tick_t time (const KeyMap & km) const
   {
-    return entry () . time;
+    return entry (km) . time;
   }
 
-  bool fresh (int expiration = 8) const
+  bool fresh (const KeyMap & km, const Clock & c, int expiration = 8) const
   {
-    expiration = global::scaled_ticks (expiration);
+    expiration = c.scaled_ticks (expiration);
 
-    const auto & e = entry ();
-    return e.state && global::ticks_elapsed - e.time <= expiration;
+    const auto & e = entry (km);
+    return e.state && c.ticks_elapsed - e.time <= (tick_t) expiration;
   }
 };
 
@@ -269,13 +350,13 @@ namespace input
      , debug_key = ' '
      ;
 
-  static int move_x ()
+  static int move_x (const KeyMap & km)
   {
-    return move_E.pressed () - move_W.pressed ();
+    return move_E.pressed (km) - move_W.pressed (km);
   }
-  static int move_y ()
+  static int move_y (const KeyMap & km)
   {
-    return move_S.pressed () - move_N.pressed ();
+    return move_S.pressed (km) - move_N.pressed (km);
   }
 };
 
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads, each with its own deque of jobs.
+//
+// Workers take jobs from the back of their own deque, and when that runs dry
+// they steal from the front of the others'. Jobs that take wildly different
+// amounts of time (a simulation that hits a wall early vs. one that doesn't)
+// then still keep every core busy until the very end.
+//
+// Every job is told which worker runs it, so that it can use per-worker
+// scratch data (like a `World`) without locking.
+//
+struct WorkStealingPool
+{
+  using Job = std::function <void (int worker)>;
+
+  struct Queue
+  {
+    std::mutex m {};
+    std::deque <Job> jobs {};
+  };
+
+  std::vector <std::unique_ptr <Queue>> queues {};
+  std::vector <std::thread> threads {};
+
+  std::mutex m {};
+  std::condition_variable wake {}, idle {};
+  std::atomic <int> pending = 0;
+  bool stopping = false;
+  int next_queue = 0;
+
+  WorkStealingPool (int n_workers = std::thread::hardware_concurrency ())
+  {
+    if (n_workers < 1) n_workers = 1;
+
+    for (int i = 0; i < n_workers; i++)
+      queues.push_back (std::make_unique <Queue> ());
+    for (int i = 0; i < n_workers; i++)
+      threads.emplace_back ([this, i] { work (i); });
+  }
+
+  ~WorkStealingPool ()
+  {
+    {
+      std::lock_guard lock (m);
+      stopping = true;
+    }
+    wake.notify_all ();
+    for (auto & t : threads)
+      t.join ();
+  }
+
+  int size () const
+  {
+    return queues.size ();
+  }
+
+  void submit (Job job)
+  {
+    pending++;
+    {
+      auto & q = *queues[next_queue];
+      next_queue = (next_queue + 1) % size ();
+      std::lock_guard lock (q.m);
+      q.jobs.push_back (std::move (job));
+    }
+    {
+      std::lock_guard lock (m);
+    }
+    wake.notify_one ();
+  }
+
+  // Blocks until every submitted job has finished
+  void wait ()
+  {
+    std::unique_lock lock (m);
+    idle.wait (lock, [this] { return pending == 0; });
+  }
+
+  // Calls `fn (i, worker)` for every i in [0, n), in chunks of `grain`,
+  // and waits for all of them.
+  template <class F>
+  void parallel_for (int n, int grain, F fn)
+  {
+    for (int lo = 0; lo < n; lo += grain)
+    {
+      const int hi = std::min (n, lo + grain);
+      submit ([lo, hi, &fn] (int worker)
+      {
+        for (int i = lo; i < hi; i++)
+          fn (i, worker);
+      });
+    }
+    wait ();
+  }
+
+private:
+  bool take (int self, Job & job)
+  {
+    {
+      auto & q = *queues[self];
+      std::lock_guard lock (q.m);
+      if (! q.jobs.empty ())
+      {
+        job = std::move (q.jobs.back ());
+        q.jobs.pop_back ();
+        return true;
+      }
+    }
+    for (int i = 1; i < size (); i++)
+    {
+      auto & q = *queues[(self + i) % size ()];
+      std::lock_guard lock (q.m);
+      if (! q.jobs.empty ())
+      {
+        job = std::move (q.jobs.front ());
+        q.jobs.pop_front ();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void work (int self)
+  {
+    for (;;)
+    {
+      Job job;
+      if (take (self, job))
+      {
+        job (self);
+        if (--pending == 0)
+        {
+          std::lock_guard lock (m);
+          idle.notify_all ();
+        }
+        continue;
+      }
+
+      std::unique_lock lock (m);
+      if (stopping)
+        return;
+      wake.wait (lock, [this] { return stopping || has_queued (); });
+    }
+  }
+
+  bool has_queued ()
+  {
+    for (auto & q : queues)
+    {
+      std::lock_guard lock (q->m);
+      if (! q->jobs.empty ())
+        return true;
+    }
+    return false;
+  }
+};
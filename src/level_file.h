@@ -0,0 +1,278 @@
+#pragma once
+
+#include "V2.h"
+#include "tilemap.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary levels, which open without parsing anything: the file is mapped
+// into memory and the rooms are used right where they are.
+//
+// File layout, native byte order:
+//
+//   header:  "VSLV" | u32 version | u32 rooms | u32 0
+//   rooms:   i32 x | i32 y | i32 w | i32 h                                (per room)
+//            | u64 tiles | u64 infos | u64 solid | u64 runs | u64 blocks [2]
+//   planes:  at those offsets, see below                                  (per room)
+//
+// `tiles` are the rooms as they were made, w * h `tile_t`, one byte per
+// tile like in the text format (see `pop_tilemap`). `infos` are the same
+// tiles autotiled, w * h `TileInfo`, what ends up in `TileMapEx::tiles`,
+// so that loading doesn't autotile. `solid`, `runs` and `blocks` are what
+// `TileMapEx` works out from those for collisions, as it keeps them, so
+// that loading doesn't do that either. `solid` is 8 byte aligned.
+//
+// The mapping is copy on write, so changing tiles while playing never
+// changes the file.
+//
+// Write one from a text level with `build/sim --convert <text> <binary>`.
+
+namespace level_file
+{
+  constexpr char     magic [4] = { 'V', 'S', 'L', 'V' };
+  constexpr uint32_t version   = 2;
+
+  struct Header
+  {
+    char     magic [4];
+    uint32_t version, rooms, reserved;
+  };
+
+  struct Room
+  {
+    int32_t  x, y, w, h;
+    uint64_t tiles, infos, solid, runs, blocks [2];
+  };
+
+  static_assert (sizeof (Header)   == 16);
+  static_assert (sizeof (Room)     == 64);
+  static_assert (sizeof (TileInfo) == 3);
+
+  // How many bytes each plane of a `w` by `h` room takes
+  inline Room plane_sizes (int32_t w, int32_t h)
+  {
+    const uint64_t n = (uint64_t) w * h;
+    const V2<int> b0 = TileMapEx::block_dims_of (0, {w, h});
+    const V2<int> b1 = TileMapEx::block_dims_of (1, {w, h});
+    return Room
+      { .x = 0, .y = 0, .w = w, .h = h
+      , .tiles  = n
+      , .infos  = n * sizeof (TileInfo)
+      , .solid  = (uint64_t) TileMapEx::stride_of ({w, h}) * h * sizeof (uint64_t)
+      , .runs   = 4 * n
+      , .blocks = { (uint64_t) b0.x * b0.y, (uint64_t) b1.x * b1.y }
+      };
+  }
+}
+
+struct LevelFile
+{
+  // The whole file, unmapped when the last copy of us goes
+  std::shared_ptr <uint8_t> data {};
+  size_t   size  = 0;
+  uint32_t rooms = 0;
+
+  // Whether `pth` starts like a binary level
+  static bool is_binary (const char * pth)
+  {
+    char m [4] {};
+    FILE * f = fopen (pth, "rb");
+    if (! f) return false;
+    const bool ok = fread (m, 1, 4, f) == 4 && memcmp (m, level_file::magic, 4) == 0;
+    fclose (f);
+    return ok;
+  }
+
+  // Maps the file and checks that the rooms are all inside it. Takes the
+  // same time however big the rooms are.
+  void open (const char * pth)
+  {
+    const int fd = ::open (pth, O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error ("Failed to open level");
+
+    struct stat st;
+    if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (level_file::Header))
+    {
+      close (fd);
+      throw std::runtime_error ("Level file is too short");
+    }
+    size = st.st_size;
+
+    void * p = mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (p == MAP_FAILED)
+      throw std::runtime_error ("Failed to map level");
+
+    const size_t sz = size;
+    data = std::shared_ptr <uint8_t> (reinterpret_cast <uint8_t *> (p), [sz] (uint8_t * q) { munmap (q, sz); });
+
+    level_file::Header h;
+    memcpy (&h, data.get (), sizeof h);
+    if (memcmp (h.magic, level_file::magic, 4) != 0)
+      throw std::runtime_error ("Not a binary level");
+    if (h.version != level_file::version)
+      throw std::runtime_error ("Unsupported level version");
+    if (h.rooms > (size - sizeof h) / sizeof (level_file::Room))
+      throw std::runtime_error ("Level file is too short");
+    rooms = h.rooms;
+
+    for (uint32_t i = 0; i < rooms; i++)
+    {
+      const auto r = room (i);
+      if (r.w <= 0 || r.h <= 0 || r.w > 1 << 15 || r.h > 1 << 15)
+        throw std::runtime_error ("Bad room size in level file");
+
+      const auto n = level_file::plane_sizes (r.w, r.h);
+      const auto fits = [&] (uint64_t at, uint64_t len) { return at <= size && len <= size - at; };
+      if ( ! fits (r.tiles, n.tiles) || ! fits (r.infos, n.infos) || ! fits (r.solid, n.solid)
+        || ! fits (r.runs, n.runs) || ! fits (r.blocks[0], n.blocks[0]) || ! fits (r.blocks[1], n.blocks[1]) )
+        throw std::runtime_error ("Level file is too short");
+      if (r.solid % alignof (uint64_t))
+        throw std::runtime_error ("Misaligned plane in level file");
+    }
+  }
+
+  level_file::Room room (int i) const
+  {
+    level_file::Room r;
+    memcpy (&r, data.get () + sizeof (level_file::Header) + i * sizeof r, sizeof r);
+    return r;
+  }
+
+  TileMap tiles (int i) const
+  {
+    const auto r = room (i);
+    return TileMap
+      { .pos   = { r.x, r.y }
+      , .size  = { r.w, r.h }
+      , .tiles = data.get () + r.tiles
+      };
+  }
+
+  // Room `i`, using the tiles and planes in the file
+  TileMapEx tilemap (int i) const
+  {
+    const auto r = room (i);
+    uint8_t * d = data.get ();
+    return TileMapEx
+      ( tiles (i)
+      , reinterpret_cast <TileInfo *> (d + r.infos)
+      , { .solid  = reinterpret_cast <uint64_t *> (d + r.solid)
+        , .runs   = d + r.runs
+        , .blocks = { d + r.blocks[0], d + r.blocks[1] }
+        }
+      );
+  }
+};
+
+// Writes rooms to `pth` as a binary level. `raw[i]` is room `i` as it was
+// made, `rooms[i]` the same room autotiled.
+void write_level_file (const char * pth, const std::vector <TileMap> & raw, const std::vector <TileMapEx> & rooms)
+{
+  FILE * f = fopen (pth, "wb");
+  if (! f)
+    throw std::runtime_error ("Failed to open level for writing");
+
+  const level_file::Header h
+    { .magic    = { 'V', 'S', 'L', 'V' }
+    , .version  = level_file::version
+    , .rooms    = (uint32_t) rooms.size ()
+    , .reserved = 0
+    };
+  fwrite (&h, sizeof h, 1, f);
+
+  std::vector <level_file::Room> rs;
+  uint64_t at = sizeof h + rooms.size () * sizeof (level_file::Room);
+  for (const auto & tm : rooms)
+  {
+    const auto n = level_file::plane_sizes (tm.size.x, tm.size.y);
+    level_file::Room r { .x = tm.pos.x, .y = tm.pos.y, .w = tm.size.x, .h = tm.size.y };
+    r.tiles = at; at += n.tiles;
+    r.infos = at; at += n.infos;
+    at = (at + 7) & ~uint64_t (7);
+    r.solid = at; at += n.solid;
+    r.runs  = at; at += n.runs;
+    for (int l = 0; l < 2; l++)
+      { r.blocks[l] = at; at += n.blocks[l]; }
+
+    fwrite (&r, sizeof r, 1, f);
+    rs.push_back (r);
+  }
+
+  uint64_t pos = sizeof h + rooms.size () * sizeof (level_file::Room);
+  const auto put = [&] (uint64_t to, const void * p, uint64_t len)
+  {
+    for (; pos < to; pos++) fputc (0, f);
+    fwrite (p, 1, len, f);
+    pos += len;
+  };
+  for (size_t i = 0; i < rooms.size (); i++)
+  {
+    const auto & r = rs[i];
+    const auto & tm = rooms[i];
+    const auto n = level_file::plane_sizes (r.w, r.h);
+    put (r.tiles, raw[i].tiles, n.tiles);
+    put (r.infos, tm.tiles,     n.infos);
+    put (r.solid, tm.solid,     n.solid);
+    put (r.runs,  tm.runs,      n.runs);
+    for (int l = 0; l < 2; l++)
+      put (r.blocks[l], tm.blocks[l], n.blocks[l]);
+  }
+
+  const bool ok = ! ferror (f);
+  if (fclose (f) != 0 || ! ok)
+    throw std::runtime_error ("Failed to write level");
+}
+
+// Turns the text level at `from` into a binary one at `to`, returns how many
+// rooms there were
+size_t convert_level (const char * from, const char * to)
+{
+  FILE * f = fopen (from, "rb");
+  if (! f)
+    throw std::runtime_error ("Failed to open level");
+
+  std::vector <TileMap>   raw;
+  std::vector <TileMapEx> rooms;
+  const auto free_raw = [&] { for (auto & tm : raw) free (tm.tiles); };
+
+  try
+  {
+    for (int c; (c = fgetc (f)) != EOF;)
+    {
+      ungetc (c, f);
+      raw.push_back (pop_tilemap (f));
+      rooms.emplace_back (raw.back ());
+    }
+  }
+  catch (...)
+  {
+    fclose (f);
+    free_raw ();
+    throw;
+  }
+  fclose (f);
+
+  try
+  {
+    write_level_file (to, raw, rooms);
+  }
+  catch (...)
+  {
+    free_raw ();
+    throw;
+  }
+
+  free_raw ();
+  return rooms.size ();
+}
@@ -3,7 +3,13 @@
 #include "input.h"
 #include "V2.h"
 #include "entity.h"
+#include "hash.h"
+#include "fixed.h"
+#include "sweep.h"
+#include "clearance.h"
 #include <cmath>
+#include <cstdint>
+#include <initializer_list>
 #include <math.h>
 #include <iostream>
 #include <fmt/core.h>
@@ -18,19 +24,23 @@ T signum (T a)
   return 0;
 }
 
-bool hit_test (V2 <float> pos, V2 <float> size);
+struct World;
+struct Level;
+struct Particles;
+
+bool hit_test (const Level & level, V2 <coord> pos, V2 <coord> size);
 
 // ----
 
 struct Player
 {
-  V2 <float> pos;
-  V2 <float> vel {};
+  V2 <coord> pos;
+  V2 <coord> vel {};
   int facing   = 1; // which direction the player facing. If we had a sprite we'd flip it when this is -1
   int n_dashes = 1; // number of times the player can dash without getting a refill
 
   // size of the players hitbox
-  static constexpr V2 <float> size = { 7.9/8.0, 11.0/8.0 };
+  static constexpr V2 <coord> size = { 7.9/8.0, 11.0/8.0 };
 
   enum DashState
   { NotDashing
@@ -41,12 +51,14 @@ struct Player
 
   // -----
 
-  Player (V2 <float> pos) : pos {pos}
+  Player (V2 <coord> pos) : pos {pos}
   {
   }
 
-  void tick ()
+  void tick (World & world)
   {
+    w = &world;
+
     do_grounding ();
 
     if (dash_state == NotDashing)
@@ -71,7 +83,7 @@ struct Player
     }
 
     // just for debugging
-    if (input::debug_key.pressed ())
+    if (pressed (input::debug_key))
       vel.y = -10;
 
     if (dash_state != DirectionPending)
@@ -79,6 +91,46 @@ struct Player
   }
 
 private:
+  // Runs the common cases of `tick` for many players at once, see batch.h
+  friend struct PlayerBatch;
+
+  // The world we are ticking in. Everything we need from it goes through
+  // the accessors below, which are defined in world.h.
+  World * w = nullptr;
+
+  // Answers most of our `hit_test`s, see clearance.h. Not part of the
+  // state, it's worked out from `pos` whenever that changes tiles.
+  Clearance around {};
+
+  Clock        & clock     ();
+  const KeyMap & keys      ();
+  Particles    & particles ();
+  bool           verbose   ();
+
+  bool hit_test (V2 <coord> pos, V2 <coord> size);
+  void count_substeps (int n, bool over_budget);
+
+  // `hit_test` for up to 32 boxes at once, bit `i` set if box `i` hits
+  // something. All of the player's collision checks end up here, see
+  // `World::collisions`.
+  uint32_t hit_tests (std::initializer_list <Rect> rects);
+
+  bool pressed (Key k)
+  {
+    return k.pressed (keys ());
+  }
+  bool fresh (Key k)
+  {
+    return k.fresh (keys (), clock ());
+  }
+
+  template <class... T>
+  void log (fmt::format_string <T...> f, T && ... args)
+  {
+    if (verbose ())
+      fmt::print (f, std::forward <T> (args)...);
+  }
+
   // Before starting a dash we freeze the game for a few frames
   // to give the player time to input a direction to dash in.
   //
@@ -98,7 +150,7 @@ private:
   static constexpr float end_dash_speed = 160.f / 8.f;
   static constexpr float dash_up_mult   = .7f;
 
-  V2 <float> dash_vel;
+  V2 <coord> dash_vel;
   tick_t time_dash_started {}; // only used for debug output
 
 
@@ -106,42 +158,42 @@ private:
   {
     if ( dash_state != NotDashing
       || n_dashes < 1
-      || dash_cooldown_timer.alive ()
-      || !( input::dash.fresh ()
-         || input::dash_down.fresh ()
+      || dash_cooldown_timer.alive (clock ())
+      || !( fresh (input::dash)
+         || fresh (input::dash_down)
           )
        )
       return false;
 
     n_dashes--;
-    time_dash_started = global::ticks_elapsed;
-    dash_cooldown_timer.start ();
-    dash_refresh_timer.start ();
+    time_dash_started = clock ().ticks_elapsed;
+    dash_cooldown_timer.start (clock ());
+    dash_refresh_timer.start (clock ());
 
     dash_state = DirectionPending;
     dash_direction.x = 0;
     dash_direction.y = 0;
 
-    // global::freeze_time (freeze_frames);
-    // global::freeze_time_seconds (global::intended_tick_time * freeze_frames);
-    global::freeze_time (global::scaled_ticks (freeze_frames));
+    // clock ().freeze_time (freeze_frames);
+    // clock ().freeze_time_seconds (global::intended_tick_time * freeze_frames);
+    clock ().freeze_time (clock ().scaled_ticks (freeze_frames));
 
     return true;
   }
   void on_dash_dir_pending ()
   {
-    const float mx = input::move_x ();
-    const float my = input::move_y ();
+    const float mx = input::move_x (keys ());
+    const float my = input::move_y (keys ());
 
     if (mx != 0 && mx != dash_direction.x)
       dash_direction.x = mx;
     if (my != 0 && my != dash_direction.y)
       dash_direction.y = my;
-    if (input::dash_down.pressed ())
+    if (pressed (input::dash_down))
       dash_direction.y = 1;
 
     if
-      /*(global::ticks_elapsed >= freeze_timeout)*/
+      /*(clock ().ticks_elapsed >= freeze_timeout)*/
       (true)
       begin_dash ();
   }
@@ -151,8 +203,8 @@ private:
   void begin_dash ()
   {
     dash_state = Dashing;
-    dash_timer.start ();
-    dash_bounce_timer.start ();
+    dash_timer.start (clock ());
+    dash_bounce_timer.start (clock ());
 
     if (dash_direction.x == 0 && dash_direction.y == 0)
       dash_direction.x = facing;
@@ -179,18 +231,18 @@ private:
     pending_ultra =
       dash_direction.y > 0 && dash_direction.x != 0;
 
-    no_fric_timer.start (120 * .215f);
+    no_fric_timer.start (clock (), 120 * .215f);
   }
   void on_dashing ()
   {
-    if (dash_timer.dead ())
+    if (dash_timer.dead (clock ()))
       end_dash ();
     else
     {
-      const auto p
-        = pos
-        + V2 <float> {size.x/2, size.y/2}
-        ;
+      const auto p = to_float
+        ( pos
+        + V2 <coord> {size.x/2, size.y/2}
+        );
 
       const float a
         = std::atan2 (dash_direction.y, -dash_direction.x)
@@ -198,15 +250,15 @@ private:
         + 0.25
         ;
 
-      if (global::ticks_elapsed % global::scaled_ticks(7) == 0)
-        particles->ps.push
+      if (clock ().ticks_elapsed % clock ().scaled_ticks(7) == 0)
+        particles ().ps.push
           ( Particle
             { .pos = p
             , .vel = 0
             , .grav = 0
-            , .size = size
-            , .birth = global::ticks_elapsed
-            , .ttl = (int) global::scaled_ticks (12)
+            , .size = to_float (size)
+            , .birth = clock ().ticks_elapsed
+            , .ttl = (int) clock ().scaled_ticks (12)
             , .r=0.0f, .g=0.0f, .b=1.0f
             , .fric = 1
             , .animate_size = false
@@ -215,9 +267,10 @@ private:
             }
           );
 
-      for (int i = 0; i < std::floor(2 * (float) 150 / global::ticks_per_sec()); i++)
-        particles->spawn
-          ( p
+      for (int i = 0; i < std::floor(2 * (float) 150 / clock ().ticks_per_sec()); i++)
+        particles ().spawn
+          ( clock ()
+          , p
           , 0.7
           , a
           , 0.05
@@ -230,9 +283,10 @@ private:
           , 2.0
           );
 
-      for (int i = 0; i < std::floor((float) 150 / global::ticks_per_sec()); i++)
-        particles->spawn
-          ( p
+      for (int i = 0; i < std::floor((float) 150 / clock ().ticks_per_sec()); i++)
+        particles ().spawn
+          ( clock ()
+          , p
           , 0.75
           , a
           , 0.1
@@ -260,69 +314,19 @@ private:
 
   // ----
 
-  static constexpr float epsilon = 0.005;
-
-  int moveX (float dx)
+  // Move as far as possible towards pos + d without going into anything,
+  // ending up exactly touching whatever is in the way, see sweep.h
+  void moveX (coord dx)
   {
-    if (std::abs(dx) < epsilon) return 0;
-    const float half = dx * 0.5;
-    const V2<float> new_pos {pos.x + half, pos.y};
-
-    if (! hit_test (new_pos, size))
-    {
-      pos = new_pos;
-    }
-
-    return 1 + moveX (half);
+    sweep::move_axis (pos, 0, dx, size, [this] (V2 <coord> p) { return hit_test (p, size); });
   }
-  int moveY (float dy)
+  void moveY (coord dy)
   {
-    if (std::abs(dy) < epsilon) return 0;
-    const float half = dy * 0.5;
-    const V2<float> new_pos {pos.x, pos.y + half};
-
-    if (! hit_test (new_pos, size))
-    {
-      pos = new_pos;
-    }
-
-    return 1 + moveY (half);
+    sweep::move_axis (pos, 1, dy, size, [this] (V2 <coord> p) { return hit_test (p, size); });
   }
-  int moveXY (float dx, float dy)
+  void moveXY (coord dx, coord dy)
   {
-    constexpr float step = epsilon;
-    const float sx = dx > 0 ? 1 : -1;
-    const float sy = dy > 0 ? 1 : -1;
-
-    if (dx*sx < step)
-    {
-      return moveY (dy);
-    }
-    if (dy*sy < step)
-    {
-      return moveX (dx);
-    }
-
-    bool stuck = true;
-
-    if (! hit_test ({pos.x+step*sx, pos.y}, size))
-    {
-      pos.x += step*sx;
-      dx -= step*sx;
-      stuck = false;
-    }
-    if (! hit_test ({pos.x, pos.y+step*sy}, size))
-    {
-      pos.y += step*sy;
-      dy -= step*sy;
-      stuck = false;
-    }
-
-    if (!stuck)
-    {
-      return 1 + moveXY (dx, dy);
-    }
-    return 1;
+    sweep::move_xy (pos, {dx, dy}, size, [this] (V2 <coord> p) { return hit_test (p, size); });
   }
 
   // when hitting something, wait a few frames before killing the speed.
@@ -337,16 +341,90 @@ private:
   static constexpr float corner_correction_fast     = 0.45f;
   static constexpr float corner_correction_fast_vel = 22.f;
 
+  // Moving further than our own size in one go could carry us right over
+  // a thin wall, so ticks like that are cut into substeps that don't. There
+  // are at most `max_substeps` of them: past that we only go as far as they
+  // take us, so that a tick costs the same however fast we are going.
+  // `World::collisions` counts both.
+  static constexpr int max_substeps = 8;
+
+  // Set by `early_grounding` when it jumps, so that `apply_velocity` stops
+  // the move that landed us and moves us at the jump's velocity instead.
+  // Only ever set while `apply_velocity` is running.
+  bool jumped_early = false;
+
+  // What the moves of a tick were cut into, for `count_substeps`
+  struct Substeps
+  {
+    int  n     = 0;
+    bool split = false, over = false;
+  };
+
+  // How many of our own sizes moving by `d` covers, on the axis where
+  // that's the most
+  static float reach (V2 <coord> d)
+  {
+    return std::max ((float) abs (d.x) / (float) size.x, (float) abs (d.y) / (float) size.y);
+  }
+
   void apply_velocity ()
   {
     if (vel.x == 0 && vel.y == 0)
       return;
 
     // const float scale = 0.01;
-    const float scale = 0.009 * global::intended_ticks_per_sec * global::dt;
-    // const float scale = global::dt / (5.f / 6.f);
-    //const float scale = global::dt / (2.f / 3.f);
-    const V2 <float> new_pos
+    const float scale = 0.009 * clock ().step_scale ();
+    // const float scale = clock ().dt / (5.f / 6.f);
+    //const float scale = clock ().dt / (2.f / 3.f);
+
+    Substeps steps {};
+    move (scale, steps);
+
+    // An early jump gets a whole tick at its own velocity on top of the
+    // part of the move that landed us, substeps or not
+    while (jumped_early)
+    {
+      jumped_early = false;
+      move (scale, steps);
+    }
+
+    if (steps.split)
+      count_substeps (steps.n, steps.over);
+  }
+
+  // Moves us by `vel * scale` in substeps, stopping after the one that
+  // lands us if we jump right away
+  void move (float scale, Substeps & steps)
+  {
+    if (vel.x == 0 && vel.y == 0)
+      return;
+
+    const float r = reach ({ vel.x * scale, vel.y * scale });
+    if (r <= 1)
+    {
+      steps.n++;
+      apply_velocity (scale);
+      return;
+    }
+
+    const bool over = r > max_substeps;
+    const int  n    = over ? max_substeps : (int) std::ceil (r);
+    steps.split = true;
+    steps.over |= over;
+
+    // Over budget, each substep goes one of our sizes
+    const float piece = over ? scale / r : scale / n;
+    for (int i = 0; i < n && (vel.x != 0 || vel.y != 0) && ! jumped_early; i++)
+    {
+      steps.n++;
+      apply_velocity (piece);
+    }
+  }
+
+  // Moves us by `vel * scale`, or as far as we get
+  void apply_velocity (float scale)
+  {
+    const V2 <coord> new_pos
       { pos.x + vel.x * scale
       , pos.y + vel.y * scale
       };
@@ -361,15 +439,19 @@ private:
       else if (vel.y == 0)
       {
         const float c
-          = std::abs(vel.x) < corner_correction_fast_vel
+          = abs(vel.x) < corner_correction_fast_vel
           ? corner_correction_slow
           : corner_correction_fast
           ;
 
-        if (const V2 <float> p {new_pos.x, new_pos.y - c}; !hit_test (p, size))
-          { pos = p; moveY(+c); if (!is_grounded) early_grounding (); } else
-        if (const V2 <float> p {new_pos.x, new_pos.y + c}; !hit_test (p, size))
-          { pos = p; moveY(-c); }
+        const V2 <coord> up   {new_pos.x, new_pos.y - c};
+        const V2 <coord> down {new_pos.x, new_pos.y + c};
+        const uint32_t h = hit_tests ({ {up, size}, {down, size} });
+
+        if (! (h & 1))
+          { pos = up; moveY(+c); if (!is_grounded) early_grounding (); } else
+        if (! (h & 2))
+          { pos = down; moveY(-c); }
         else
         {
           moveX (vel.x * scale);
@@ -380,20 +462,24 @@ private:
       else if (vel.x == 0)
       {
         const float c
-          = std::abs(vel.y) < corner_correction_fast_vel
+          = abs(vel.y) < corner_correction_fast_vel
          || vel.y > 0 // don't want to slip into the pit!
           ? corner_correction_slow
           : corner_correction_fast
           ;
 
-        if (const V2 <float> p {new_pos.x - c, new_pos.y}; !hit_test (p, size))
-          { pos = p; moveX(+c); } else
-        if (const V2 <float> p {new_pos.x + c, new_pos.y}; !hit_test (p, size))
-          { pos = p; moveX(-c); }
+        const V2 <coord> left  {new_pos.x - c, new_pos.y};
+        const V2 <coord> right {new_pos.x + c, new_pos.y};
+        const uint32_t h = hit_tests ({ {left, size}, {right, size} });
+
+        if (! (h & 1))
+          { pos = left; moveX(+c); } else
+        if (! (h & 2))
+          { pos = right; moveX(-c); }
         else
         {
           moveY (vel.y * scale);
-          const float old_vy = vel.y; vel.y = 0;
+          const coord old_vy = vel.y; vel.y = 0;
 
           if (old_vy > 0 && !is_grounded)
             early_grounding ();
@@ -437,7 +523,7 @@ private:
     // TODO: refund lost mileage upon getting unstuck?
     //
     {
-      const int grace = std::round (((secs) slide_grace) * global::tick_mult ());
+      const int grace = std::round (((secs) slide_grace) * clock ().tick_mult ());
 
       if (x_moved)
         x_slide = 0;
@@ -487,11 +573,11 @@ private:
   {
     on_grounded ();
     is_grounded = true;
-    time_grounded = global::ticks_elapsed;
+    time_grounded = clock ().ticks_elapsed;
 
     if (try_dash ())
     {
-      std::cout << "early dash" << std::endl;
+      log ("early dash\n");
 
       // Crucially we do NOT attempt to jump here because we are
       // waiting for a game freeze, which is handeled downstream.
@@ -506,8 +592,9 @@ private:
     }
     else if (do_jumping ())
     {
-      apply_velocity ();
-      std::cout << "early jump" << std::endl;
+      // `apply_velocity` moves us once it's done with the move we landed in
+      jumped_early = true;
+      log ("early jump\n");
     }
   }
 
@@ -515,12 +602,12 @@ private:
   {
     return false; // TODO:
 
-    if (! input::jump.fresh () )
+    if (! fresh (input::jump) )
       return false;
-    if (! input::climb.pressed () )
+    if (! pressed (input::climb) )
       return false;
 
-    fmt::print ("corner boost\n");
+    log ("corner boost\n");
 
     dash_state = NotDashing;
     /*is_climbing = true;*/
@@ -543,8 +630,8 @@ private:
       ? 0.15 // for the purpose of landing
       : 0.40 // for the purpose of refreshing dashes and things like air-supers
       ;
-    const V2 <float> fpos  { pos.x, pos.y + size.y };
-    const V2 <float> fsize { size.x, feet_box_h };
+    const V2 <coord> fpos  { pos.x, pos.y + size.y };
+    const V2 <coord> fsize { size.x, feet_box_h };
     return hit_test(fpos, fsize);
   }
 
@@ -564,30 +651,31 @@ private:
     if (gnew)
     {
       cayotee_timer.stop();
-      time_grounded = global::ticks_elapsed;
+      time_grounded = clock ().ticks_elapsed;
     }
     else
     {
-      cayotee_timer.start();
-      time_ungrounded = global::ticks_elapsed;
+      cayotee_timer.start (clock ());
+      time_ungrounded = clock ().ticks_elapsed;
     }
   }
 
   void on_grounded ()
   {
-    if (dash_refresh_timer.dead ())
+    if (dash_refresh_timer.dead (clock ()))
       n_dashes = 1;
 
     if (! is_grounded && vel.y >= 0)
     {
-      const auto p
-        = pos
-        + V2 <float> {size.x/2, size.y + 0.0}
-        ;
+      const auto p = to_float
+        ( pos
+        + V2 <coord> {size.x/2, size.y + 0.0}
+        );
 
       for (int i = 0; i < 6; i++)
-      particles->spawn
-        ( p
+      particles ().spawn
+        ( clock ()
+        , p
         , V2 <float> { 0.3, 0.0 }
         , 0.5
         , 0.5
@@ -625,18 +713,17 @@ private:
 
   void do_movement ()
   {
-    if (no_move_timer.alive ())
+    if (no_move_timer.alive (clock ()))
       return;
 
-    const float mx = input::move_x ();
-    float vx = vel.x;
+    const float mx = input::move_x (keys ());
+    coord vx = vel.x;
 
     const auto m_sign = signum (mx);
     const auto v_sign = signum (vx);
 
     const auto mult
-      = global::intended_ticks_per_sec
-      * global::dt
+      = clock ().step_scale ()
       * 1.0;
 
     if (mx != 0)
@@ -660,7 +747,7 @@ private:
     }
     else
     {
-      if (no_fric_timer.alive ()) return;
+      if (no_fric_timer.alive (clock ())) return;
       /*fmt::print("friction\n");*/
       auto fric = get_friction ();
       const auto vx2  = vx - v_sign * fric * walk_reduce * mult;
@@ -684,14 +771,14 @@ private:
   float get_gravity ()
   {
     float g = gravity_accel;
-    if (input::jump.pressed ()) // gravity discounts if holding jump
+    if (pressed (input::jump)) // gravity discounts if holding jump
     {
-      if (zero_grav_timer.alive ())
+      if (zero_grav_timer.alive (clock ()))
         g = 0;
       else
         g *= 0.5;
     }
-    g *= global::intended_ticks_per_sec * global::dt;
+    g *= clock ().step_scale ();
     return g;
   }
 
@@ -701,7 +788,7 @@ private:
     if (vel.y >= gravity_max) // gravity should not slow you down
       return;
     const float g = get_gravity ();
-    vel.y = std::min<float>(gravity_max, vel.y + g);
+    vel.y = std::min<coord>(gravity_max, vel.y + g);
   }
 
 
@@ -721,9 +808,9 @@ private:
 
   bool do_jumping ()
   {
-    if (!input::jump.fresh ())
+    if (!fresh (input::jump))
       return false;
-    if (input::jump.time () <= time_last_jump)
+    if (input::jump.time (keys ()) <= time_last_jump)
       return false;
 
     if (is_climbing)
@@ -737,8 +824,8 @@ private:
 
     if (! is_grounded)
     {
-      /*if ( time_ungrounded + cayotee_time < global::ticks_elapsed*/
-      if ( cayotee_timer.dead ()
+      /*if ( time_ungrounded + cayotee_time < clock ().ticks_elapsed*/
+      if ( cayotee_timer.dead (clock ())
         || time_ungrounded <= time_last_jump // you only get 1 jump!
          ) return try_walljump ();
 
@@ -748,12 +835,12 @@ private:
     {
       is_grounded = false;
       cayotee_timer.stop ();
-      time_ungrounded = global::ticks_elapsed;
+      time_ungrounded = clock ().ticks_elapsed;
       is_bunny = time_grounded == time_ungrounded;
     }
 
-    time_last_jump = global::ticks_elapsed;
-    zero_grav_timer.start (zero_grav_time);
+    time_last_jump = clock ().ticks_elapsed;
+    zero_grav_timer.start (clock (), zero_grav_time);
     vel.y = -jump_liftoff;
 
     if (dash_state == Dashing)
@@ -767,20 +854,20 @@ private:
       vel.x = super_speed * dash_direction.x;
 
       if (n_dashes > 0)
-        fmt::print ("extended ");
+        log ("extended ");
 
       // allows reversing supers and hypers
       {
-        const float mx = input::move_x ();
+        const float mx = input::move_x (keys ());
         if (mx != 0 && mx != dash_direction.x)
         {
           vel.x *= -1;
-          fmt::print ("reverse ");
+          log ("reverse ");
         }
       }
 
-      if (is_cayotee) fmt::print ("cayotee ");
-      if (is_bunny  ) fmt::print ("bunny ");
+      if (is_cayotee) log ("cayotee ");
+      if (is_bunny  ) log ("bunny ");
 
       if (dash_direction.y > 0)
       {
@@ -790,29 +877,30 @@ private:
         // hypers and wave dashes are equivallent, but it is technically
         // called a wave dash if you started mid-air.
         if (time_dash_started < time_grounded)
-          fmt::print ("wave ");
+          log ("wave ");
         else
-          fmt::print ("hyper ");
+          log ("hyper ");
 
       }
       else
-        fmt::print ("super ");
+        log ("super ");
 
       {
-        const auto p
-          = pos
-          + V2 <float> {size.x/2, size.y * 0.9}
-          ;
+        const auto p = to_float
+          ( pos
+          + V2 <coord> {size.x/2, size.y * 0.9}
+          );
 
         const float a
-          = std::atan2 (0.2, -signum(vel.x))
+          = std::atan2 (0.2, (float) -signum(vel.x))
           / (3.141592*2)
           + 0.25
           ;
 
         for (int i = 0; i < 8; i++)
-        particles->spawn
-          ( p
+        particles ().spawn
+          ( clock ()
+          , p
           , 0.5
           , a
           , 0.10
@@ -826,12 +914,12 @@ private:
           );
       }
 
-      fmt::print ("dash\n");
+      log ("dash\n");
     }
     else
     {
-      if (is_cayotee) fmt::print ("cayotee ");
-      if (is_bunny  ) fmt::print ("bunny ");
+      if (is_cayotee) log ("cayotee ");
+      if (is_bunny  ) log ("bunny ");
 
       // We always apply the ultra boost, but don't
       // bother logging it unless significant speed was gained.
@@ -839,7 +927,7 @@ private:
       bool nice_ultra = false;
       if (pending_ultra)
       {
-        nice_ultra = std::abs(vel.x) >= dash_speed;
+        nice_ultra = abs(vel.x) >= dash_speed;
 
         vel.x *= ultra_boost;
       }
@@ -872,10 +960,10 @@ private:
 
       if (nice_ultra)
       {
-        fmt::print ("ultra: {}\n", vel.x);
+        log ("ultra: {}\n", vel.x);
       }
       else if (is_cayotee || is_bunny)
-        fmt::print ("jump\n");
+        log ("jump\n");
     }
 
     pending_ultra = false;
@@ -897,16 +985,18 @@ private:
 
   int wall_check (float dist)
   {
-    return hit_test ({pos.x - dist, pos.y}, {dist, size.y})
-         ? -1
-         : hit_test ({pos.x + size.x, pos.y}, {dist, size.y})
-         ? +1
+    const uint32_t h = hit_tests
+      ({ { {pos.x - dist, pos.y}, {dist, size.y} }
+       , { {pos.x + size.x, pos.y}, {dist, size.y} }
+       });
+    return h & 1 ? -1
+         : h & 2 ? +1
          : 0;
   }
 
   bool try_walljump ()
   {
-    if (vel.x != 0 || vel.y >= 0 || dash_bounce_timer.dead ())
+    if (vel.x != 0 || vel.y >= 0 || dash_bounce_timer.dead (clock ()))
 
     // wall jump
     {
@@ -916,17 +1006,17 @@ private:
       const int wall_dir = wall_check (walljump_wall_dist);
       if (wall_dir == 0) return false;
 
-      const float mx = input::move_x ();
+      const float mx = input::move_x (keys ());
 
       vel.x = -walljump_speed_x * wall_dir;
       vel.y = -jump_liftoff;
 
       if (mx == 0)
       {
-        zero_grav_timer.start(12);
-        no_move_timer.start (4);
+        zero_grav_timer.start (clock (), 12);
+        no_move_timer.start (clock (), 4);
 
-        fmt::print ("neutral jump\n");
+        log ("neutral jump\n");
 
         // Neutral jumps are performed by letting go of all directional input
         // before a wall jump. Unlike regular walljumps, neutrals allow you
@@ -937,13 +1027,13 @@ private:
       else if (mx != wall_dir)
       {
         // kick away from the wall
-        zero_grav_timer.start(zero_grav_time);
-        no_move_timer.start (8);
+        zero_grav_timer.start (clock (), zero_grav_time);
+        no_move_timer.start (clock (), 8);
         facing = -mx;
       }
       else
       {
-        no_move_timer.start (18);
+        no_move_timer.start (clock (), 18);
       }
 
     }
@@ -957,16 +1047,16 @@ private:
       dash_state = NotDashing;
       dash_bounce_timer.stop ();
 
-      zero_grav_timer.start(zero_grav_time);
-      no_move_timer.start(3);
+      zero_grav_timer.start (clock (), zero_grav_time);
+      no_move_timer.start (clock (), 3);
 
       vel.x = -wallbounce_speed_x * wall_dir;
       vel.y = -wallbounce_speed_y;
 
-      fmt::print ("wall bounce\n");
+      log ("wall bounce\n");
     }
 
-    time_last_jump = global::ticks_elapsed;
+    time_last_jump = clock ().ticks_elapsed;
 
     return true;
   }
@@ -979,7 +1069,7 @@ private:
 
   bool try_climb ()
   {
-    if (!input::climb.pressed ())
+    if (!pressed (input::climb))
       return false;
 
     if (facing > 0)
@@ -1008,7 +1098,7 @@ private:
     {
       is_climbing = false;
 
-      if (!input::climb.pressed ())
+      if (!pressed (input::climb))
         return;
 
       if (facing > 0)
@@ -1025,7 +1115,7 @@ private:
       is_climbing = true;
     }
 
-    const float my = input::move_y ();
+    const float my = input::move_y (keys ());
     if (my == 0)
     {
       if (vel.y >= 0)
@@ -1033,7 +1123,7 @@ private:
       else
       {
         const float g = get_gravity ();
-        vel.y = std::min<float>(0, vel.y + g);
+        vel.y = std::min<coord>(0, vel.y + g);
       }
     }
     else if (signum(vel.y) == my)
@@ -1043,7 +1133,7 @@ private:
       else
       {
         const float g = get_gravity ();
-        vel.y = std::min<float>(-climb_speed, vel.y + g);
+        vel.y = std::min<coord>(-climb_speed, vel.y + g);
       }
     }
     else
@@ -1054,18 +1144,18 @@ private:
 
   void climb_jump ()
   {
-    const float mx = input::move_x ();
+    const float mx = input::move_x (keys ());
 
     vel.y -= jump_liftoff;
-    time_last_jump = global::ticks_elapsed;
+    time_last_jump = clock ().ticks_elapsed;
 
     if (mx != -facing)
     {
-      zero_grav_timer.start(10);
+      zero_grav_timer.start (clock (), 10);
     }
     else
     {
-      zero_grav_timer.start(zero_grav_time);
+      zero_grav_timer.start (clock (), zero_grav_time);
       vel.x = mx * walljump_speed_x;
       is_climbing = false;
       facing *= -1;
@@ -1080,6 +1170,20 @@ public:
     // but how to access those in a clean way..
   }
 
+  // Everything `tick` reads from one tick to the next, see hash.h
+  void hash (StateHash & h) const
+  {
+    h.add
+      ( pos, vel, facing, n_dashes, (int) dash_state
+      , dash_direction, dash_vel, pending_ultra
+      , dash_timer, dash_cooldown_timer, dash_refresh_timer, dash_bounce_timer
+      , x_slide, y_slide
+      , is_grounded, cayotee_timer, time_ungrounded, time_grounded
+      , no_move_timer, no_fric_timer, zero_grav_timer
+      , time_last_jump, is_climbing
+      );
+  }
+
 private:
 
 };
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "V2.h"
+#include "world.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Which solid tile a ray runs into first, for lines of sight, look-ahead
+// and projectiles.
+//
+// Walks the tiles the ray passes through one at a time, in order (Amanatides
+// & Woo): at every step it crosses whichever tile edge, vertical or
+// horizontal, is closer along the ray. The cost is the number of tiles
+// crossed, not the distance over some sampling step, and no thin wall or
+// corner gets skipped. Blocks of tiles that are all empty (see
+// `TileMapEx::block`), and empty cells of the level between and around the
+// rooms (see `RoomIndex::occupancy`), are crossed in one go.
+//
+// Rays go from room to room like the player does. Tiles that are in no room
+// are empty.
+
+struct Ray
+{
+  V2 <float> origin {};
+  V2 <float> dir    {}; // needn't be normalized
+  float max_dist = 0;   // in tiles
+};
+
+struct RayHit
+{
+  bool       hit    = false;
+  V2 <int>   tile   {}; // the solid tile that was hit
+  V2 <float> point  {}; // where the ray entered it, or where it ran out
+  V2 <int>   normal {}; // the side it came in through, facing the ray; 0, 0 if it started inside
+  float      dist   = 0;
+};
+
+// Answers "is this tile solid" for tiles next to each other, keeping hold of
+// the room the last one was in. Only rooms that don't overlap any other are
+// kept, so that it always agrees with `hit_test_int`.
+struct TileProbe
+{
+  const Level & level;
+  const TileMapEx * tm = nullptr;
+
+  bool solid (V2 <int> c)
+  {
+    if (! tm || ! pt_in_rect <int> (c, tm->pos, tm->size))
+    {
+      const int i = room_at (level, c);
+      if (i < 0) return false;
+      if (! level.rooms.alone[i])
+      {
+        tm = nullptr;
+        return level.tilemaps[i].is_solid (c - level.tilemaps[i].pos);
+      }
+      tm = &level.tilemaps[i];
+    }
+    return tm->is_solid (c - tm->pos);
+  }
+
+  // If tile `c` is in an empty cell of the level, or an empty block of the
+  // room we're in, the tiles of the biggest such block, from `b0` to `b1`
+  // (inside the room for blocks)
+  bool empty_block (V2 <int> c, V2 <int> & b0, V2 <int> & b1) const
+  {
+    if (level.rooms.cell (c) == TileMapEx::Empty)
+    {
+      level.rooms.cell_tiles (c, b0, b1);
+      return true;
+    }
+    if (! tm || ! pt_in_rect <int> (c, tm->pos, tm->size)) return false;
+
+    const V2 <int> p = c - tm->pos;
+    for (int l = 1; l >= 0; l--)
+    {
+      if (tm->block_at (l, p) != TileMapEx::Empty) continue;
+
+      const int sh = TileMapEx::block_shift[l];
+      b0 = { (p.x >> sh) << sh, (p.y >> sh) << sh };
+      b1 = { std::min (b0.x + (1 << sh), tm->size.x) - 1, std::min (b0.y + (1 << sh), tm->size.y) - 1 };
+      b0 = b0 + tm->pos;
+      b1 = b1 + tm->pos;
+      return true;
+    }
+    return false;
+  }
+};
+
+RayHit raycast (TileProbe & probe, const Ray & r)
+{
+  constexpr float inf = std::numeric_limits <float>::infinity ();
+
+  const V2 <float> o = r.origin;
+  V2 <int> c { (int) std::floor (o.x), (int) std::floor (o.y) };
+
+  RayHit h {};
+  h.point = o;
+  if (probe.solid (c))
+  {
+    h.hit  = true;
+    h.tile = c;
+    return h;
+  }
+
+  const float len = std::sqrt (r.dir.x * r.dir.x + r.dir.y * r.dir.y);
+  if (len == 0) return h;
+  const V2 <float> d { r.dir.x / len, r.dir.y / len };
+
+  const V2 <int> step { (d.x > 0) - (d.x < 0), (d.y > 0) - (d.y < 0) };
+
+  // How far along the ray one tile is on each axis, and how far it is to
+  // the next tile edge
+  const V2 <float> delta { step.x ? std::abs (1 / d.x) : inf, step.y ? std::abs (1 / d.y) : inf };
+  V2 <float> next
+    { step.x > 0 ? (c.x + 1 - o.x) * delta.x : step.x < 0 ? (o.x - c.x) * delta.x : inf
+    , step.y > 0 ? (c.y + 1 - o.y) * delta.y : step.y < 0 ? (o.y - c.y) * delta.y : inf
+    };
+
+  float t;
+  V2 <int> n;
+  const auto advance = [&]
+  {
+    if (next.x < next.y)
+    {
+      t = next.x;
+      c.x += step.x;
+      next.x += delta.x;
+      n = { -step.x, 0 };
+    }
+    else
+    {
+      t = next.y;
+      c.y += step.y;
+      next.y += delta.y;
+      n = { 0, -step.y };
+    }
+  };
+
+  // If we're in an empty block, goes straight to the tile just past where
+  // the ray leaves it, without looking at anything in between
+  const auto jump_empty = [&]
+  {
+    V2 <int> b0, b1;
+    if (! probe.empty_block (c, b0, b1)) return false;
+
+    const int kx = step.x > 0 ? b1.x - c.x : c.x - b0.x;
+    const int ky = step.y > 0 ? b1.y - c.y : c.y - b0.y;
+    const float tx = step.x ? next.x + kx * delta.x : inf;
+    const float ty = step.y ? next.y + ky * delta.y : inf;
+
+    if (tx < ty)
+    {
+      t = tx;
+      c.x = step.x > 0 ? b1.x + 1 : b0.x - 1;
+      c.y = std::clamp ((int) std::floor (o.y + d.y * t), b0.y, b1.y);
+      n = { -step.x, 0 };
+    }
+    else
+    {
+      t = ty;
+      c.y = step.y > 0 ? b1.y + 1 : b0.y - 1;
+      c.x = std::clamp ((int) std::floor (o.x + d.x * t), b0.x, b1.x);
+      n = { 0, -step.y };
+    }
+
+    next =
+      { step.x > 0 ? (c.x + 1 - o.x) * delta.x : step.x < 0 ? (o.x - c.x) * delta.x : inf
+      , step.y > 0 ? (c.y + 1 - o.y) * delta.y : step.y < 0 ? (o.y - c.y) * delta.y : inf
+      };
+    return true;
+  };
+
+  for (;;)
+  {
+    if (! jump_empty ())
+      advance ();
+    if (t > r.max_dist) break;
+
+    if (probe.solid (c))
+    {
+      h.hit    = true;
+      h.tile   = c;
+      h.normal = n;
+      h.dist   = t;
+      h.point  = { o.x + d.x * t, o.y + d.y * t };
+      return h;
+    }
+  }
+
+  h.dist  = r.max_dist;
+  h.point = { o.x + d.x * r.max_dist, o.y + d.y * r.max_dist };
+  return h;
+}
+
+RayHit raycast (const Level & level, V2 <float> origin, V2 <float> dir, float max_dist)
+{
+  TileProbe probe { level };
+  return raycast (probe, { origin, dir, max_dist });
+}
+
+// Many rays at once, `out[i]` for `rays[i]`. Rays that start close together,
+// like a fan of them from one spot, share the room lookups.
+void raycasts (const Level & level, const Ray * rays, RayHit * out, int n)
+{
+  TileProbe probe { level };
+  for (int i = 0; i < n; i++)
+    out[i] = raycast (probe, rays[i]);
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include "V2.h"
+#include "input.h"
+#include "hash.h"
+#include "fixed.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Input recordings: every `KeyMap::put` together with the frame it happened on.
+//
+// Since the simulation is deterministic (see `global::fixed_timestep`), feeding the
+// same key events on the same frames, starting from the same state, reproduces the
+// whole session without needing a window or vsync.
+//
+// File layout:
+//
+//   header:  "VSRP" | u8 version | u16 ticks per sec | u8 fixed | i32 screen | x | y | u64 frames
+//   events:  varint frame delta | varint zigzag key | u8 action | mods << 2
+//   hashes:  varint frame delta | varint 0          | u8 3 | u64 state hash
+//
+// The frame is `global::frames_elapsed` when the event was received, deltas are against
+// the previous event. The scancode is not recorded since `KeyMap::put` ignores it.
+// `frames` is the length of the session and is patched in when the recording is closed;
+// a recording that was never closed (crash) has 0 frames and plays until its last event.
+//
+// `fixed` is 1 for recordings made by a FIXED_POINT build (see fixed.h), which store x and
+// y as i32 `Fixed::raw`, and 0 for float builds, which store them as f32. The two builds
+// move differently, so a recording only plays back on the kind of build that made it.
+// Recordings before version 3 have no `fixed` byte and are float.
+//
+// Every `hash_every` frames the recorder also writes `World::state_hash` (see hash.h),
+// marked by action 3 which no key event uses. Playing back compares them against its own
+// to find the first frame where the replay stopped doing what the recording did.
+// Version 1 recordings have no hashes and play back without checking.
+
+namespace replay
+{
+  constexpr char    magic [4] = { 'V', 'S', 'R', 'P' };
+  constexpr uint8_t version   = 3;
+
+  constexpr int     hash_action = 3;
+  constexpr tick_t  hash_every  = 16;
+
+  // Where the player was when the recording started
+  struct Start
+  {
+    int screen;
+    V2 <coord> pos;
+  };
+
+  static void put_varint (std::vector <uint8_t> & buf, uint64_t v)
+  {
+    while (v >= 0x80)
+    {
+      buf.push_back ((v & 0x7f) | 0x80);
+      v >>= 7;
+    }
+    buf.push_back (v);
+  }
+
+  template <class T>
+  static void put_raw (std::vector <uint8_t> & buf, T v)
+  {
+    const auto * p = reinterpret_cast <const uint8_t *> (&v);
+    buf.insert (buf.end (), p, p + sizeof (T));
+  }
+
+  static uint64_t zigzag   (int64_t  v) { return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63); }
+  static int64_t  unzigzag (uint64_t v) { return (int64_t) (v >> 1) ^ -(int64_t) (v & 1); }
+}
+
+// ----
+
+struct InputRecorder
+{
+  FILE * f = nullptr;
+  std::vector <uint8_t> buf {};
+  tick_t last_frame = 0;
+
+  // offset of the `frames` field in the header
+  static constexpr long frames_offset = 4 + 1 + 2 + 1 + 4 + 4 + 4;
+
+  bool recording () const
+  {
+    return f != nullptr;
+  }
+
+  void open (const char * pth, replay::Start start)
+  {
+    f = fopen (pth, "wb");
+    if (!f)
+      throw std::runtime_error ("Failed to open recording for writing");
+
+    buf.insert (buf.end (), replay::magic, replay::magic + 4);
+    replay::put_raw <uint8_t>  (buf, replay::version);
+    replay::put_raw <uint16_t> (buf, global::intended_ticks_per_sec);
+    replay::put_raw <uint8_t>  (buf, global::fixed_point);
+    replay::put_raw <int32_t>  (buf, start.screen);
+    put_coord (start.pos.x);
+    put_coord (start.pos.y);
+    replay::put_raw <uint64_t> (buf, 0);
+    last_frame = 0;
+  }
+
+  void put (tick_t frame, int key, int action, int mods)
+  {
+    if (!f) return;
+
+    replay::put_varint (buf, frame - last_frame);
+    replay::put_varint (buf, replay::zigzag (key));
+    buf.push_back ((action & 3) | (mods << 2));
+    last_frame = frame;
+
+    if (buf.size () >= (1 << 16))
+      flush ();
+  }
+
+  // Call after every frame, once the world has ticked
+  void put_hash (tick_t frame, const StateHash & h)
+  {
+    if (!f || frame % replay::hash_every != 0) return;
+
+    replay::put_varint (buf, frame - last_frame);
+    replay::put_varint (buf, 0);
+    buf.push_back (replay::hash_action);
+    replay::put_raw <uint64_t> (buf, h.value ());
+    last_frame = frame;
+  }
+
+  void put_coord (float v) { replay::put_raw <float>   (buf, v); }
+  void put_coord (Fixed v) { replay::put_raw <int32_t> (buf, v.raw); }
+
+  void flush ()
+  {
+    fwrite (buf.data (), 1, buf.size (), f);
+    buf.clear ();
+  }
+
+  void close (tick_t frames)
+  {
+    if (!f) return;
+
+    flush ();
+    const uint64_t n = frames;
+    fseek (f, frames_offset, SEEK_SET);
+    fwrite (&n, sizeof (n), 1, f);
+    fclose (f);
+    f = nullptr;
+  }
+};
+
+// ----
+
+struct InputReplay
+{
+  std::vector <uint8_t> data {};
+  size_t at = 0;
+
+  replay::Start start {};
+  tick_t frames = 0;
+
+  // frame of the event at `at`
+  tick_t next_frame = 0;
+
+  void load (const char * pth)
+  {
+    FILE * f = fopen (pth, "rb");
+    if (!f)
+      throw std::runtime_error ("Failed to open recording");
+
+    fseek (f, 0, SEEK_END);
+    data.resize (ftell (f));
+    fseek (f, 0, SEEK_SET);
+    const size_t n = fread (data.data (), 1, data.size (), f);
+    fclose (f);
+
+    // (version 2 headers are a byte shorter)
+    if (n != data.size () || n < (size_t) InputRecorder::frames_offset + 7
+     || memcmp (data.data (), replay::magic, 4) != 0)
+      throw std::runtime_error ("Not a recording");
+
+    at = 4;
+    const uint8_t v = get_raw <uint8_t> ();
+    if (v < 1 || v > replay::version)
+      throw std::runtime_error ("Unsupported recording version");
+    if (get_raw <uint16_t> () != global::intended_ticks_per_sec)
+      throw std::runtime_error ("Recording was made at a different tick rate");
+    if (const bool fixed = v >= 3 && get_raw <uint8_t> (); fixed != global::fixed_point)
+      throw std::runtime_error (fixed ? "Recording was made by a fixed point build"
+                                      : "Recording was made by a float build");
+
+    start.screen = get_raw <int32_t> ();
+    get_coord (start.pos.x);
+    get_coord (start.pos.y);
+    frames       = get_raw <uint64_t> ();
+
+    next_frame = 0;
+    if (!done ())
+      next_frame = get_varint ();
+  }
+
+  bool done () const
+  {
+    return at >= data.size ();
+  }
+
+  // Number of frames to play: the length of the session, or up to the
+  // last event if the recording was not closed properly.
+  tick_t length ()
+  {
+    if (frames) return frames;
+
+    tick_t n = 0;
+    const size_t at0 = at;
+    const tick_t next0 = next_frame;
+    KeyEvent e;
+    HashRecord h;
+    for (Next r; (r = next (e, h)) != End;)
+      n = r == GotKey ? e.frame : h.frame;
+    at = at0;
+    next_frame = next0;
+    return n + 1;
+  }
+
+  struct KeyEvent
+  {
+    tick_t frame;
+    int key, action, mods;
+  };
+
+  struct HashRecord
+  {
+    tick_t frame;
+    uint64_t hash;
+  };
+
+  // Calls `fn` with every event that happened on or before `frame`, and
+  // `on_hash` with every recorded state hash
+  template <class F, class H>
+  void feed (tick_t frame, F fn, H on_hash)
+  {
+    KeyEvent e;
+    HashRecord h;
+    while (!done () && next_frame <= frame)
+    {
+      const Next r = next (e, h);
+      if (r == GotKey)  fn (e);
+      if (r == GotHash) on_hash (h);
+      if (r == End)     break;
+    }
+  }
+
+  template <class F>
+  void feed (tick_t frame, F fn)
+  {
+    feed (frame, fn, [] (const HashRecord &) {});
+  }
+
+private:
+  enum Next { End, GotKey, GotHash };
+
+  Next next (KeyEvent & e, HashRecord & h)
+  {
+    if (done ()) return End;
+
+    const tick_t frame = next_frame;
+    const int key = replay::unzigzag (get_varint ());
+    const uint8_t am = get_raw <uint8_t> ();
+
+    Next r = GotKey;
+    if ((am & 3) == replay::hash_action)
+    {
+      h.frame = frame;
+      h.hash  = get_raw <uint64_t> ();
+      r = GotHash;
+    }
+    else
+    {
+      e.frame  = frame;
+      e.key    = key;
+      e.action = am & 3;
+      e.mods   = am >> 2;
+    }
+
+    if (!done ())
+      next_frame += get_varint ();
+
+    return r;
+  }
+
+  uint64_t get_varint ()
+  {
+    uint64_t v = 0;
+    for (int shift = 0; at < data.size (); shift += 7)
+    {
+      const uint8_t b = data[at++];
+      v |= (uint64_t) (b & 0x7f) << shift;
+      if (!(b & 0x80)) break;
+    }
+    return v;
+  }
+
+  template <class T>
+  T get_raw ()
+  {
+    T v {};
+    if (at + sizeof (T) <= data.size ())
+      memcpy (&v, data.data () + at, sizeof (T));
+    at += sizeof (T);
+    return v;
+  }
+
+  void get_coord (float & v) { v = get_raw <float> (); }
+  void get_coord (Fixed & v) { v = Fixed::from_raw (get_raw <int32_t> ()); }
+};
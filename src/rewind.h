@@ -0,0 +1,329 @@
+#pragma once
+
+#include "input.h"
+#include "entity.h"
+#include "world.h"
+#include "snapshot.h"
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// The last minute of play, for rewinding while practicing.
+//
+// A full `Snapshot` per frame would be 8640 of them at 144 Hz, around 400 MB
+// with the particle slots. Instead the frames are grouped into segments of
+// `keyframe_every` frames. The first frame of a segment is a keyframe, stored
+// whole; the others only store how they differ from it:
+//
+//   core:       the snapshot minus the particles, xor'ed with the keyframe and
+//               run-length encoded. Most of it is the keymap, which hardly
+//               ever changes, so this is usually a few dozen bytes.
+//
+//   particles:  particles move every tick, so xor'ing them would not save
+//               much. But they also move in a way that doesn't depend on
+//               anything but the clock, so we store what `Particles::tick`
+//               can't predict: the new ones spawned during the frame.
+//
+//   varint zero run | varint literal run | literal bytes | ...   (core)
+//   u8 0                                                         (particles unchanged)
+//   u8 1 | varint n | n particles                                (ticked, then n spawned)
+//   u8 2 | varint n | n particles                                (anything else)
+//
+// Getting a frame back decodes the keyframe and replays the particles of the
+// frames before it in its segment, so it costs at most `keyframe_every`
+// particle ticks.
+//
+struct Rewind
+{
+  static constexpr tick_t capacity       = 60 * global::intended_ticks_per_sec;
+  static constexpr int    keyframe_every = 128;
+
+  struct Segment
+  {
+    std::vector <uint8_t>  key;    // core bytes, then the particles
+    std::vector <uint8_t>  deltas; // every other frame, one after the other
+    std::vector <uint32_t> ends;   // where each delta ends in `deltas`
+
+    tick_t frames () const
+    {
+      return 1 + ends.size ();
+    }
+  };
+
+  std::deque <Segment> segments {};
+  tick_t frames = 0;
+
+  // Saves the state of `w` as the newest frame, forgetting the oldest ones
+  // once there are more than `capacity`.
+  void push (const World & w)
+  {
+    cur->save (w);
+
+    if (segments.empty () || segments.back ().frames () == keyframe_every)
+    {
+      start_segment ();
+      *base = *cur;
+    }
+    else
+    {
+      Segment & s = segments.back ();
+      put_core (s.deltas);
+      put_particles (s.deltas);
+      s.ends.push_back (s.deltas.size ());
+    }
+
+    prev->copy_from (cur->particles);
+    frames++;
+
+    while (frames - segments.front ().frames () >= capacity)
+    {
+      frames -= segments.front ().frames ();
+      spare.push_back (std::move (segments.front ()));
+      segments.pop_front ();
+    }
+  }
+
+  // Goes back one frame and puts `w` there. Returns false once there is
+  // nothing older left, in which case `w` is put at the oldest frame.
+  bool step_back (World & w)
+  {
+    if (frames == 0)
+      return false;
+
+    const bool ok = frames > 1;
+    if (ok)
+    {
+      Segment & s = segments.back ();
+      if (s.ends.empty ())
+      {
+        spare.push_back (std::move (s));
+        segments.pop_back ();
+      }
+      else
+      {
+        s.ends.pop_back ();
+        s.deltas.resize (s.ends.empty () ? 0 : s.ends.back ());
+      }
+      frames--;
+    }
+
+    decode_last ();
+
+    // Keys that went up or down while rewinding stay that way, but not as
+    // fresh presses; the game would otherwise think they're still held down
+    // (or up) from back then.
+    const KeyMap live = w.keymap;
+    cur->restore (w);
+    for (int k = 0; k < key_count; k++)
+      if (w.keymap.m[k].state != live.m[k].state)
+        w.keymap.m[k] = { .state = live.m[k].state, .time = tick_t_never };
+
+    return ok;
+  }
+
+  void clear ()
+  {
+    while (! segments.empty ())
+    {
+      spare.push_back (std::move (segments.back ()));
+      segments.pop_back ();
+    }
+    frames = 0;
+  }
+
+  // Memory held by the ring, not counting the scratch snapshots
+  size_t bytes () const
+  {
+    size_t n = 0;
+    const auto add = [&] (const Segment & s)
+    {
+      n += s.key.capacity () + s.deltas.capacity () + s.ends.capacity () * sizeof (uint32_t);
+    };
+    for (const auto & s : segments) add (s);
+    for (const auto & s : spare)    add (s);
+    return n;
+  }
+
+private:
+  // Heap allocated, they're about 45 KB each
+  std::unique_ptr <Snapshot>    base = std::make_unique <Snapshot> (); // keyframe of the newest segment
+  std::unique_ptr <Snapshot>    cur  = std::make_unique <Snapshot> ();
+  std::unique_ptr <ParticleBuf> prev = std::make_unique <ParticleBuf> (); // particles of the newest frame
+  std::unique_ptr <ParticleBuf> tmp  = std::make_unique <ParticleBuf> ();
+
+  // Dropped segments, kept around so their buffers can be reused
+  std::vector <Segment> spare {};
+
+  void start_segment ()
+  {
+    if (spare.empty ())
+      segments.emplace_back ();
+    else
+    {
+      segments.push_back (std::move (spare.back ()));
+      spare.pop_back ();
+    }
+
+    Segment & s = segments.back ();
+    s.key.assign (cur->core (), cur->core () + cur->core_size ());
+    put_particle_list (s.key, cur->particles, 0, cur->particles.n);
+    s.deltas.clear ();
+    s.ends.clear ();
+  }
+
+  // ---- encoding
+
+  static void put_varint (std::vector <uint8_t> & buf, uint64_t v)
+  {
+    while (v >= 0x80)
+    {
+      buf.push_back ((v & 0x7f) | 0x80);
+      v >>= 7;
+    }
+    buf.push_back (v);
+  }
+
+  static uint64_t get_varint (const uint8_t *& p)
+  {
+    uint64_t v = 0;
+    for (int shift = 0;; shift += 7)
+    {
+      const uint8_t b = *p++;
+      v |= (uint64_t) (b & 0x7f) << shift;
+      if (!(b & 0x80)) return v;
+    }
+  }
+
+  static void put_particle_list (std::vector <uint8_t> & buf, const ParticleBuf & ps, int from, int to)
+  {
+    put_varint (buf, to - from);
+    const auto * p = reinterpret_cast <const uint8_t *> (ps.ps + from);
+    buf.insert (buf.end (), p, p + (to - from) * sizeof (Particle));
+  }
+
+  static const uint8_t * get_particle_list (const uint8_t * p, ParticleBuf & ps)
+  {
+    const int n = get_varint (p);
+    memcpy (ps.ps + ps.n, p, n * sizeof (Particle));
+    ps.n += n;
+    return p + n * sizeof (Particle);
+  }
+
+  // `cur` xor `base`, as runs of zeros and literal bytes. Compares a word
+  // at a time, since almost all of it is zeros.
+  void put_core (std::vector <uint8_t> & buf) const
+  {
+    const uint8_t * a = cur->core ();
+    const uint8_t * b = base->core ();
+    const size_t n = cur->core_size ();
+
+    const auto same = [&] (size_t i)
+    {
+      uint64_t x, y;
+      memcpy (&x, a + i, 8);
+      memcpy (&y, b + i, 8);
+      return x == y;
+    };
+
+    size_t i = 0;
+    while (i < n)
+    {
+      const size_t z0 = i;
+      while (i + 8 <= n && same (i)) i += 8;
+      while (i < n && a[i] == b[i]) i++;
+      if (i == n) break;
+
+      const size_t l0 = i;
+      while (i < n && a[i] != b[i]) i++;
+
+      put_varint (buf, l0 - z0);
+      put_varint (buf, i - l0);
+      for (size_t j = l0; j < i; j++)
+        buf.push_back (a[j] ^ b[j]);
+    }
+    put_varint (buf, 0);
+    put_varint (buf, 0);
+  }
+
+  void put_particles (std::vector <uint8_t> & buf)
+  {
+    const ParticleBuf & now = cur->particles;
+
+    if (now.n == prev->n && memcmp (now.ps, prev->ps, now.n * sizeof (Particle)) == 0)
+    {
+      buf.push_back (0);
+      return;
+    }
+
+    // What the particles would look like if the frame only ticked them
+    ParticleBuf & guess = *tmp;
+    guess.copy_from (*prev);
+    guess.tick (cur->clock);
+
+    const int k = guess.n;
+    if (k <= now.n && memcmp (now.ps, guess.ps, k * sizeof (Particle)) == 0)
+    {
+      buf.push_back (1);
+      put_particle_list (buf, now, k, now.n);
+    }
+    else
+    {
+      buf.push_back (2);
+      put_particle_list (buf, now, 0, now.n);
+    }
+  }
+
+  // ---- decoding
+
+  static const uint8_t * apply_core (const uint8_t * p, uint8_t * out)
+  {
+    for (;;)
+    {
+      const size_t zeros = get_varint (p);
+      const size_t lits  = get_varint (p);
+      if (zeros == 0 && lits == 0)
+        return p;
+
+      out += zeros;
+      for (size_t j = 0; j < lits; j++)
+        *out++ ^= *p++;
+    }
+  }
+
+  // Puts the newest frame into `cur`, and gets `base` and `prev` ready to
+  // carry on pushing after it
+  void decode_last ()
+  {
+    const Segment & s = segments.back ();
+    const size_t n = cur->core_size ();
+
+    memcpy (base->core (), s.key.data (), n);
+    base->particles.n = 0;
+    get_particle_list (s.key.data () + n, base->particles);
+
+    if (s.ends.empty ())
+      memcpy (cur->core (), base->core (), n);
+
+    cur->particles.copy_from (base->particles);
+
+    for (size_t i = 0; i < s.ends.size (); i++)
+    {
+      const uint8_t * p = s.deltas.data () + (i ? s.ends[i-1] : 0);
+
+      memcpy (cur->core (), base->core (), n);
+      p = apply_core (p, cur->core ());
+
+      const uint8_t mode = *p++;
+      if (mode == 1)
+        cur->particles.tick (cur->clock);
+      if (mode == 2)
+        cur->particles.n = 0;
+      if (mode != 0)
+        get_particle_list (p, cur->particles);
+    }
+
+    prev->copy_from (cur->particles);
+  }
+};
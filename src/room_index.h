@@ -0,0 +1,219 @@
+#pragma once
+
+#include "V2.h"
+#include "tilemap.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Which rooms are where, so that collision checks don't have to look at
+// every room in the level.
+//
+// A uniform grid of cells `1 << shift` tiles wide, each listing the rooms
+// that overlap it in ascending order. The player is about a tile big, so a
+// query almost always lands in a single cell with one or two rooms in it.
+//
+// Cells start out 32 tiles wide and get bigger until there are no more than
+// a few cells per room, so levels that are spread far apart don't end up
+// with a grid that is mostly empty.
+//
+// Each cell also knows whether its tiles are all empty, all solid or some of
+// each, like the blocks of a room (see `TileMapEx::block`) one level up and
+// over the whole level, so that big boxes and long rays can skip the empty
+// space around and between rooms.
+//
+struct RoomIndex
+{
+  int shift = 5;
+  V2 <int> origin {}; // the top left cell
+  V2 <int> dims   {}; // in cells
+
+  std::vector <uint32_t> starts {}; // where each cell's rooms start in `ids`
+  std::vector <uint32_t> ids    {};
+
+  // cell range of every room, inclusive
+  std::vector <V2 <int>> lo {}, hi {};
+
+  // whether a room has no tiles in common with any other room
+  std::vector <uint8_t> alone {};
+
+  // what's in each cell; tiles that are in no room are empty. Keep it up to
+  // date with `update` when tiles change.
+  using Occupancy = TileMapEx::Occupancy;
+  std::vector <Occupancy> occupancy {};
+
+  void build (const std::vector <TileMapEx> & rooms)
+  {
+    *this = RoomIndex {};
+    if (rooms.empty ()) return;
+
+    V2 <int> p0 = rooms[0].pos, p1 = p0;
+    for (const auto & tm : rooms)
+    {
+      p0 = { std::min (p0.x, tm.pos.x), std::min (p0.y, tm.pos.y) };
+      p1 = { std::max (p1.x, tm.pos.x + tm.size.x), std::max (p1.y, tm.pos.y + tm.size.y) };
+    }
+
+    const int64_t max_cells = std::max <int64_t> (1024, 16 * rooms.size ());
+    for (;; shift++)
+    {
+      origin = { p0.x >> shift, p0.y >> shift };
+      dims   = { (p1.x >> shift) - origin.x + 1, (p1.y >> shift) - origin.y + 1 };
+      if ((int64_t) dims.x * dims.y <= max_cells) break;
+    }
+
+    for (const auto & tm : rooms)
+    {
+      lo.push_back (cell_of (tm.pos));
+      hi.push_back (cell_of ({ tm.pos.x + tm.size.x - 1, tm.pos.y + tm.size.y - 1 }));
+    }
+
+    // Count, then fill
+    starts.assign (dims.x * dims.y + 1, 0);
+    for (size_t i = 0; i < rooms.size (); i++)
+      for_cells (lo[i], hi[i], [&] (int c) { starts[c + 1]++; });
+    for (size_t c = 1; c < starts.size (); c++)
+      starts[c] += starts[c - 1];
+
+    ids.resize (starts.back ());
+    std::vector <uint32_t> at (starts.begin (), starts.end () - 1);
+    for (size_t i = 0; i < rooms.size (); i++)
+      for_cells (lo[i], hi[i], [&] (int c) { ids[at[c]++] = i; });
+
+    for (size_t i = 0; i < rooms.size (); i++)
+    {
+      const auto & a = rooms[i];
+      const V2 <int> a1 { a.pos.x + a.size.x - 1, a.pos.y + a.size.y - 1 };
+      alone.push_back (! any (a.pos, a1, [&] (int j)
+      {
+        const auto & b = rooms[j];
+        return j != (int) i
+            && a.pos.x < b.pos.x + b.size.x && b.pos.x <= a1.x
+            && a.pos.y < b.pos.y + b.size.y && b.pos.y <= a1.y;
+      }));
+    }
+
+    occupancy.resize (dims.x * dims.y);
+    for (int c = 0; c < dims.x * dims.y; c++)
+      occupancy[c] = occupancy_of (rooms, c);
+  }
+
+  // Works out the cells with the tiles from `p0` to `p1` in them again,
+  // after those changed
+  void update (const std::vector <TileMapEx> & rooms, V2 <int> p0, V2 <int> p1)
+  {
+    V2 <int> c0 = cell_of (p0), c1 = cell_of (p1);
+    c0 = { std::max (c0.x, 0), std::max (c0.y, 0) };
+    c1 = { std::min (c1.x, dims.x - 1), std::min (c1.y, dims.y - 1) };
+    for_cells (c0, c1, [&] (int c) { occupancy[c] = occupancy_of (rooms, c); });
+  }
+
+  // What's in the cell that tile `p` is in
+  Occupancy cell (V2 <int> p) const
+  {
+    const V2 <int> c = cell_of (p);
+    if (c.x < 0 || c.x >= dims.x || c.y < 0 || c.y >= dims.y)
+      return TileMapEx::Empty;
+    return occupancy[c.x + c.y * dims.x];
+  }
+
+  // The tiles of the cell that tile `p` is in, from `c0` to `c1`
+  void cell_tiles (V2 <int> p, V2 <int> & c0, V2 <int> & c1) const
+  {
+    c0 = { (p.x >> shift) << shift, (p.y >> shift) << shift };
+    c1 = { c0.x + (1 << shift) - 1, c0.y + (1 << shift) - 1 };
+  }
+
+  // Whether every tile from `p0` to `p1` (inclusive) is in an empty cell
+  bool empty (V2 <int> p0, V2 <int> p1) const
+  {
+    V2 <int> c0 = cell_of (p0), c1 = cell_of (p1);
+    c0 = { std::max (c0.x, 0), std::max (c0.y, 0) };
+    c1 = { std::min (c1.x, dims.x - 1), std::min (c1.y, dims.y - 1) };
+
+    for (int y = c0.y; y <= c1.y; y++)
+    for (int x = c0.x; x <= c1.x; x++)
+      if (occupancy[x + y * dims.x] != TileMapEx::Empty)
+        return false;
+    return true;
+  }
+
+  // Calls `fn` with the index of every room that might overlap the tiles
+  // from `p0` to `p1` (inclusive), each once and in ascending order within a
+  // cell, until it returns true. Returns whether it did.
+  template <class F>
+  bool any (V2 <int> p0, V2 <int> p1, F fn) const
+  {
+    if (ids.empty ()) return false;
+
+    V2 <int> c0 = cell_of (p0), c1 = cell_of (p1);
+    c0 = { std::max (c0.x, 0), std::max (c0.y, 0) };
+    c1 = { std::min (c1.x, dims.x - 1), std::min (c1.y, dims.y - 1) };
+
+    for (int y = c0.y; y <= c1.y; y++)
+    for (int x = c0.x; x <= c1.x; x++)
+    {
+      const int c = x + y * dims.x;
+      for (uint32_t k = starts[c]; k < starts[c + 1]; k++)
+      {
+        const uint32_t i = ids[k];
+
+        // A room that spans several of the cells we look at is only
+        // reported from the first of them
+        if ((x != c0.x && lo[i].x < x) || (y != c0.y && lo[i].y < y))
+          continue;
+
+        if (fn ((int) i))
+          return true;
+      }
+    }
+    return false;
+  }
+
+  template <class F>
+  bool any (V2 <int> p, F fn) const
+  {
+    return any (p, p, fn);
+  }
+
+private:
+  // Empty if no room has a solid tile in cell `c`, full if a room that
+  // overlaps no other covers all of it with solid tiles
+  Occupancy occupancy_of (const std::vector <TileMapEx> & rooms, int c) const
+  {
+    const V2 <int> t0 { (c % dims.x + origin.x) << shift, (c / dims.x + origin.y) << shift };
+    const V2 <int> t1 { t0.x + (1 << shift) - 1, t0.y + (1 << shift) - 1 };
+
+    bool any = false;
+    for (uint32_t k = starts[c]; k < starts[c + 1]; k++)
+    {
+      const uint32_t i = ids[k];
+      const auto & tm = rooms[i];
+
+      // The part of the cell in the room, relative to the room
+      const V2 <int> a { std::max (t0.x, tm.pos.x) - tm.pos.x, std::max (t0.y, tm.pos.y) - tm.pos.y };
+      const V2 <int> b { std::min (t1.x, tm.pos.x + tm.size.x - 1) - tm.pos.x, std::min (t1.y, tm.pos.y + tm.size.y - 1) - tm.pos.y };
+      if (a.x > b.x || a.y > b.y || ! tm.any_solid (a.x, a.y, b.x, b.y))
+        continue;
+      any = true;
+
+      const bool covers = b.x - a.x == t1.x - t0.x && b.y - a.y == t1.y - t0.y;
+      if (covers && alone[i] && tm.all_solid (a.x, a.y, b.x, b.y))
+        return TileMapEx::Full;
+    }
+    return any ? TileMapEx::Mixed : TileMapEx::Empty;
+  }
+
+  V2 <int> cell_of (V2 <int> p) const
+  {
+    return { (p.x >> shift) - origin.x, (p.y >> shift) - origin.y };
+  }
+
+  template <class F>
+  void for_cells (V2 <int> c0, V2 <int> c1, F fn) const
+  {
+    for (int y = c0.y; y <= c1.y; y++)
+    for (int x = c0.x; x <= c1.x; x++)
+      fn (x + y * dims.x);
+  }
+};
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "V2.h"
+#include <optional>
 #include <vector>
 #include "tilemap.h"
+#include "player.h"
+#include "world.h"
 #include <fmt/core.h>
 
 // ----
@@ -40,6 +43,23 @@ std::vector <RoomMeta> make_room_metas ()
   return vec;
 }
 
+// Where to start a player in `room`: its first respawn point, nudged up
+// until the player is clear of the floor.
+std::optional <V2 <coord>> room_spawn (const Level & level, int room)
+{
+  const auto metas = make_room_metas ();
+  if (room < 0 || room >= (int) metas.size () || metas[room].respawn_points.empty ())
+    return std::nullopt;
+
+  const auto & tm = level.tilemaps[room];
+  const auto p = metas[room].respawn_points[0];
+
+  V2 <coord> pos { (coord) (tm.pos.x + p.x), (coord) (tm.pos.y + p.y) };
+  while (hit_test (level, pos, Player::size))
+    pos.y -= 0.125;
+  return pos;
+}
+
 // ----
 
 struct Room
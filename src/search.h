@@ -0,0 +1,418 @@
+#pragma once
+
+#include "V2.h"
+#include "input.h"
+#include "world.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "jobs.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+// Searches for the fastest way out of a room by simulating input sequences.
+//
+// This is a beam search: every `hold` ticks, each state in the beam branches
+// out into every combination of held keys (see `Action`). The children are
+// ranked by the time spent so far plus an optimistic estimate of the time left
+// to reach the exit edge, states that round to the same quantized state are
+// merged, and the best `beam_width` of them make up the next beam.
+//
+// Expanding the children is where all the time goes, so it is spread across a
+// `WorkStealingPool`, with one `World` per worker.
+//
+// The winning route comes out as a list of key events, which can be written to
+// a recording and played back with `build/sim --replay`.
+
+namespace search
+{
+  enum Edge { Left, Right, Top, Bottom };
+
+  enum Outcome { Inside, Exited, Lost };
+
+  // Which keys are held, one bit each
+  using Action = uint8_t;
+
+  enum ActionBit : Action
+  { A_left  = 1 << 0
+  , A_right = 1 << 1
+  , A_up    = 1 << 2
+  , A_down  = 1 << 3
+  , A_jump  = 1 << 4
+  , A_dash  = 1 << 5
+  , A_climb = 1 << 6
+  };
+
+  static constexpr Key action_keys [] =
+    { input::move_W
+    , input::move_E
+    , input::move_N
+    , input::move_S
+    , input::jump
+    , input::dash
+    , input::climb
+    };
+
+  // Every sensible combination: at most one horizontal and one vertical
+  // direction, with any of jump, dash and climb.
+  static std::vector <Action> all_actions ()
+  {
+    std::vector <Action> v;
+    for (Action x : { 0, (int) A_left, (int) A_right })
+    for (Action y : { 0, (int) A_up,   (int) A_down  })
+    for (Action b = 0; b < 8; b++)
+      v.push_back (x | y | (b << 4));
+    return v;
+  }
+
+  // Roughly the fastest the player can go without ultras, in tiles per tick;
+  // dashes move 30 tiles/sec of velocity, scaled by 0.009 per tick.
+  static constexpr float max_speed = 30.f * 0.009f;
+
+  struct KeyEvent
+  {
+    tick_t frame;
+    int key;
+    int action;
+  };
+
+  struct Route
+  {
+    bool found = false;
+    tick_t frames = 0;
+    std::vector <KeyEvent> events {};
+  };
+}
+
+struct RouteSearch
+{
+  const Level & level;
+
+  // where to start
+  int start_screen;
+  V2 <coord> start_pos;
+
+  search::Edge exit = search::Right;
+
+  int    beam_width = 256;
+  int    hold       = 4;     // ticks between decisions
+  tick_t max_frames = 2000;
+
+  WorkStealingPool pool;
+
+  RouteSearch (const Level & level, int start_screen, V2 <coord> start_pos, int n_threads)
+    : level { level }
+    , start_screen { start_screen }
+    , start_pos { start_pos }
+    , pool { n_threads }
+  {
+  }
+
+  search::Route run ()
+  {
+    using namespace search;
+
+    const auto actions = all_actions ();
+
+    // One world per worker to simulate in
+    std::vector <World> worlds (pool.size (), make_world ());
+
+    struct Node
+    {
+      Snapshot snap;
+      Action held;
+    };
+
+    // The beam, and for every generation so far which node of the previous
+    // generation each node came from and what it pressed to get there.
+    std::vector <std::unique_ptr <Node>> beam;
+    std::vector <std::vector <std::pair <int, Action>>> history;
+
+    {
+      auto root = std::make_unique <Node> ();
+      root->snap.save (worlds[0]);
+      root->held = 0;
+      beam.push_back (std::move (root));
+      history.push_back ({ { -1, 0 } });
+    }
+
+    struct Child
+    {
+      int parent;
+      Action action;
+      float score;
+      uint64_t key;
+      Outcome outcome;
+      tick_t frames;
+    };
+
+    Route best {};
+    int best_gen = -1, best_idx = -1;
+
+    for (int gen = 1; ! beam.empty () && (tick_t) gen * hold <= max_frames; gen++)
+    {
+      std::vector <Child> children (beam.size () * actions.size ());
+
+      pool.parallel_for (children.size (), 64, [&] (int i, int worker)
+      {
+        const int parent = i / actions.size ();
+        const Action a = actions[i % actions.size ()];
+        World & w = worlds[worker];
+
+        beam[parent]->snap.restore (w);
+        Child & c = children[i];
+        c.parent = parent;
+        c.action = a;
+        c.outcome = simulate (w, beam[parent]->held, a, c.frames);
+        c.key     = quantize (w, a);
+        c.score   = c.frames + distance_to_exit (w) / max_speed;
+      });
+
+      // Children that made it out are finished routes; the rest compete
+      // for a spot in the next beam, unless they can't beat the best route.
+      std::vector <int> order;
+      for (int i = 0; i < (int) children.size (); i++)
+      {
+        const auto & c = children[i];
+        if (c.outcome == Lost)
+          continue;
+        if (c.outcome == Exited)
+        {
+          if (! best.found || c.frames < best.frames)
+          {
+            best.found  = true;
+            best.frames = c.frames;
+            best_gen = gen;
+            best_idx = i;
+          }
+        }
+        else if (! best.found || c.score < best.frames)
+          order.push_back (i);
+      }
+
+      std::sort (order.begin (), order.end (), [&] (int a, int b)
+      {
+        return children[a].score < children[b].score;
+      });
+
+      std::unordered_set <uint64_t> seen;
+      std::vector <int> picked;
+      for (int i : order)
+      {
+        if ((int) picked.size () >= beam_width) break;
+        if (seen.insert (children[i].key).second)
+          picked.push_back (i);
+      }
+
+      // Remember how we got to the winner before the beam moves on
+      if (best_gen == gen)
+      {
+        const auto & c = children[best_idx];
+        history.push_back ({ { c.parent, c.action } });
+        best.events = route_events (history, gen);
+        history.pop_back ();
+      }
+
+      // Simulate the survivors once more to keep their full state around
+      std::vector <std::unique_ptr <Node>> next (picked.size ());
+      std::vector <std::pair <int, Action>> links (picked.size ());
+
+      pool.parallel_for (picked.size (), 8, [&] (int j, int worker)
+      {
+        const auto & c = children[picked[j]];
+        World & w = worlds[worker];
+        tick_t frames;
+
+        beam[c.parent]->snap.restore (w);
+        simulate (w, beam[c.parent]->held, c.action, frames);
+
+        next[j] = std::make_unique <Node> ();
+        next[j]->snap.save (w);
+        next[j]->held = c.action;
+        links[j] = { c.parent, c.action };
+      });
+
+      beam = std::move (next);
+      history.push_back (std::move (links));
+    }
+
+    return best;
+  }
+
+  // Writes a route as a recording that `build/sim --replay` can play back.
+  // The route is played once more on the way, for the state hashes.
+  void save (const search::Route & route, const char * pth) const
+  {
+    InputRecorder rec {};
+    rec.open (pth, { .screen = start_screen, .pos = start_pos });
+
+    World w = make_world ();
+    size_t i = 0;
+    const auto feed = [&] (tick_t frame)
+    {
+      for (; i < route.events.size () && route.events[i].frame <= frame; i++)
+      {
+        const auto & e = route.events[i];
+        rec.put (e.frame, e.key, e.action, 0);
+        w.on_key (e.key, 0, e.action, 0);
+      }
+    };
+
+    feed (0);
+    for (tick_t f = 0; f < route.frames; f++)
+    {
+      w.step ();
+      rec.put_hash (w.clock.frames_elapsed, w.state_hash);
+      feed (w.clock.frames_elapsed);
+    }
+
+    rec.close (route.frames);
+  }
+
+private:
+  World make_world () const
+  {
+    World w { level };
+    w.verbose = false;
+    w.current_screen = start_screen;
+    w.player = Player (start_pos);
+    return w;
+  }
+
+  const TileMapEx & room () const
+  {
+    return level.tilemaps[start_screen];
+  }
+
+  V2 <float> player_center (const World & w) const
+  {
+    return to_float (w.player.pos + V2 <coord> { w.player.size.x/2, w.player.size.y/2 });
+  }
+
+  // How far the player still has to go, in tiles. 0 once past the edge.
+  float distance_to_exit (const World & w) const
+  {
+    const auto & tm = room ();
+    const auto c = player_center (w);
+    float d = 0;
+    switch (exit)
+    {
+      case search::Left:   d = c.x - tm.pos.x; break;
+      case search::Right:  d = tm.pos.x + tm.size.x - c.x; break;
+      case search::Top:    d = c.y - tm.pos.y; break;
+      case search::Bottom: d = tm.pos.y + tm.size.y - c.y; break;
+    }
+    return std::max (0.f, d);
+  }
+
+  // Moves from holding `held` to holding `a` and runs `hold` ticks, or until
+  // the player leaves the room. `frames` is when the segment ended.
+  search::Outcome simulate (World & w, search::Action held, search::Action a, tick_t & frames) const
+  {
+    press_keys (w, held, a, [&] (const search::KeyEvent & e)
+    {
+      w.on_key (e.key, 0, e.action, 0);
+    });
+
+    auto outcome = search::Inside;
+    for (int t = 0; t < hold && outcome == search::Inside; t++)
+    {
+      w.step ();
+      outcome = where (w);
+    }
+
+    frames = w.clock.frames_elapsed;
+    return outcome;
+  }
+
+  // Leaving through any other edge, or falling out of the level, is a dead end
+  search::Outcome where (const World & w) const
+  {
+    const auto & tm = room ();
+    const auto c = player_center (w);
+    const V2 <float> p { (float) tm.pos.x,  (float) tm.pos.y  };
+    const V2 <float> s { (float) tm.size.x, (float) tm.size.y };
+
+    if (pt_in_rect (c, p, s))
+      return search::Inside;
+
+    const bool across = c.x >= p.x && c.x < p.x + s.x;
+    const bool along  = c.y >= p.y && c.y < p.y + s.y;
+    bool out = false;
+    switch (exit)
+    {
+      case search::Left:   out = along  && c.x <  p.x;       break;
+      case search::Right:  out = along  && c.x >= p.x + s.x; break;
+      case search::Top:    out = across && c.y <  p.y;       break;
+      case search::Bottom: out = across && c.y >= p.y + s.y; break;
+    }
+    return out ? search::Exited : search::Lost;
+  }
+
+  template <class F>
+  static void press_keys (const World & w, search::Action held, search::Action a, F fn)
+  {
+    const search::Action changed = held ^ a;
+    for (int b = 0; b < 7; b++)
+    {
+      if (!(changed & (1 << b))) continue;
+      fn (search::KeyEvent
+        { .frame  = w.clock.frames_elapsed
+        , .key    = search::action_keys[b] ()
+        , .action = (a & (1 << b)) ? key_press : key_release
+        });
+    }
+  }
+
+  // States that quantize to the same key are considered the same state
+  static uint64_t quantize (const World & w, search::Action held)
+  {
+    const auto & p = w.player;
+    const auto q = [] (float v, float step) { return (uint64_t) (int64_t) std::floor (v / step); };
+
+    uint64_t h = 0xcbf29ce484222325;
+    const auto mix = [&h] (uint64_t v) { h = (h ^ v) * 0x100000001b3; };
+    mix (q ((float) p.pos.x, 0.125f));
+    mix (q ((float) p.pos.y, 0.125f));
+    mix (q ((float) p.vel.x, 1.f));
+    mix (q ((float) p.vel.y, 1.f));
+    mix (p.dash_state);
+    mix (p.n_dashes);
+    mix (p.facing + 1);
+    mix (held);
+    mix (w.clock.is_frozen);
+    return h;
+  }
+
+  // The key events along the route ending at the first node of generation `gen`
+  std::vector <search::KeyEvent> route_events
+    ( const std::vector <std::vector <std::pair <int, search::Action>>> & history
+    , int gen
+    ) const
+  {
+    std::vector <search::Action> path;
+    for (int g = gen, i = 0; g > 0; g--)
+    {
+      const auto & [parent, a] = history[g][i];
+      path.push_back (a);
+      i = parent;
+    }
+    std::reverse (path.begin (), path.end ());
+
+    // Replay the route to get the frame of every key event
+    World w = make_world ();
+    std::vector <search::KeyEvent> events;
+    search::Action held = 0;
+    tick_t frames;
+    for (auto a : path)
+    {
+      press_keys (w, held, a, [&] (const search::KeyEvent & e) { events.push_back (e); });
+      simulate (w, held, a, frames);
+      held = a;
+    }
+    return events;
+  }
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "input.h"
+#include "entity.h"
+#include "player.h"
+#include "world.h"
+#include <type_traits>
+
+// The complete state of a `World`, minus the level data which never changes
+// at runtime. Restoring a snapshot puts the world back exactly where it was
+// when the snapshot was saved; ticking on from there with the same inputs
+// gives the same result every time.
+//
+// Everything is stored inline, so a snapshot can be copied around with a
+// plain memcpy. Saving and restoring copies a few KB, most of which is the
+// keymap, plus whichever particles are alive.
+//
+struct Snapshot
+{
+  Player player { V2 <coord> {} };
+  int current_screen;
+  Camera cam;
+
+  Clock clock;
+  KeyMap keymap;
+
+  Rng rng;
+  StateHash state_hash;
+
+  // Last, so that everything before it can be treated as one block of bytes
+  // (see `core`) and the mostly unused particle slots don't get in the way.
+  ParticleBuf particles;
+
+  // Everything but the particles
+  uint8_t       * core ()       { return reinterpret_cast <uint8_t       *> (this); }
+  const uint8_t * core () const { return reinterpret_cast <const uint8_t *> (this); }
+
+  size_t core_size () const
+  {
+    return reinterpret_cast <const uint8_t *> (&particles) - core ();
+  }
+
+  void save (const World & w)
+  {
+    player         = w.player;
+    current_screen = w.current_screen;
+    cam            = w.cam;
+    clock          = w.clock;
+    keymap         = w.keymap;
+    rng            = w.particles.rng;
+    state_hash     = w.state_hash;
+
+    particles.copy_from (w.particles.ps);
+  }
+
+  void restore (World & w) const
+  {
+    w.player         = player;
+    w.current_screen = current_screen;
+    w.cam            = cam;
+    w.clock          = clock;
+    w.keymap         = keymap;
+    w.particles.rng  = rng;
+    w.state_hash     = state_hash;
+
+    w.particles.ps.copy_from (particles);
+  }
+};
+
+static_assert (std::is_trivially_copyable_v <Snapshot>);
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "V2.h"
+#include "fixed.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+// Moving a box through the tile grid until it touches something.
+//
+// `hit (pos)` says whether the box at `pos` overlaps anything solid. For
+// `hit_test` that answer only changes where one of the box's edges crosses
+// a whole tile coordinate (rooms and tiles are all on the integer grid), so
+// instead of probing along the way we only look at those crossings, in the
+// order the box reaches them. Between two crossings the answer stays the
+// same, so the first crossing that is blocked is where the box stops.
+//
+// Rounding puts the actual crossing within an ulp or two of where we compute
+// it, so around each crossing we look float by float to find the last
+// position that is still free: the box ends up exactly touching the wall,
+// not somewhere within a tolerance of it.
+//
+// Moving one axis costs one `hit` when nothing is in the way, plus one per
+// tile edge crossed and a few more at the point of contact, or three when
+// the box is already touching something that way.
+//
+// Works the same on `Fixed` coordinates, where an ulp is one step and the
+// crossings come out exact.
+//
+namespace sweep
+{
+  constexpr int window = 2; // ulps either side of a crossing
+
+  // `std::nextafter` towards `dir`, without the call into libm: the floats
+  // next to a finite, nonzero one are the integers next to its bits. Sweeps
+  // step through a few of these at every contact, on every tick.
+  inline float next (float v, float dir)
+  {
+    if (v == 0)
+      return dir > 0 ? std::numeric_limits <float>::denorm_min () : -std::numeric_limits <float>::denorm_min ();
+    if (! std::isfinite (v))
+      return std::nextafter (v, dir * std::numeric_limits <float>::infinity ());
+
+    const uint32_t b = std::bit_cast <uint32_t> (v);
+    return std::bit_cast <float> ((v > 0) == (dir > 0) ? b + 1 : b - 1);
+  }
+  inline Fixed next (Fixed v, Fixed dir)
+  {
+    return Fixed::from_raw (v.raw + (dir.raw > 0 ? 1 : -1));
+  }
+
+  // Moves `pos` by up to `d` along `axis` (0 for x, 1 for y), stopping just
+  // short of anything solid. Returns how far it got.
+  template <class T, class Hit>
+  T move_axis (V2 <T> & pos, int axis, T d, V2 <T> size, Hit hit)
+  {
+    using std::floor, std::ceil, std::abs;
+
+    if (d == 0) return 0;
+
+    T & p = axis ? pos.y : pos.x;
+    const T s = axis ? size.y : size.x;
+    const T p0 = p, to = p0 + d;
+    const T dir = d > 0 ? 1 : -1;
+
+    const auto at = [&] (T v)
+    {
+      V2 <T> q = pos;
+      (axis ? q.y : q.x) = v;
+      return hit (q);
+    };
+    // whether `a` comes before `b` on the way
+    const auto before = [&] (T a, T b)
+    {
+      return dir > 0 ? a < b : a > b;
+    };
+
+    // Short moves can't skip over a whole tile, so if the end is free so is
+    // everything in between
+    if (abs (d) <= s && ! at (to))
+    {
+      p = to;
+      return d;
+    }
+    if (at (p0))
+      return 0; // already stuck in something, don't make it worse
+    if (at (next (p0, dir)))
+      return 0; // already touching it
+
+    // The whole coordinates each edge crosses, starting from the one it's
+    // at (or just behind it), since leaving it can already make a difference
+    const T lead0  = dir > 0 ? p0 + s : p0;
+    const T trail0 = dir > 0 ? p0     : p0 + s;
+    const T lead_off  = lead0  - p0;
+    const T trail_off = trail0 - p0;
+
+    T kl = dir > 0 ? floor (lead0)  : ceil (lead0);
+    T kt = dir > 0 ? floor (trail0) : ceil (trail0);
+
+    T free = p0; // the furthest position known to be free
+    for (;;)
+    {
+      const T tl = kl - lead_off;
+      const T tt = kt - trail_off;
+      const bool lead_first = ! before (tt, tl);
+      T t = lead_first ? tl : tt;
+
+      // Skip the ones behind us
+      if (before (t, free))
+      {
+        if (lead_first) kl += dir; else kt += dir;
+        continue;
+      }
+
+      // Past the end of the move?
+      T lo = t;
+      for (int i = 0; i < window; i++) lo = next (lo, -dir);
+      if (! before (lo, to))
+        break;
+
+      T hi = t;
+      for (int i = 0; i < window; i++) hi = next (hi, dir);
+      if (before (to, hi)) hi = to;
+
+      if (at (hi))
+      {
+        // Blocked somewhere around here; find the exact float
+        T v = before (free, lo) ? lo : next (free, dir);
+        while (before (v, hi) || v == hi)
+        {
+          if (at (v)) break;
+          free = v;
+          v = next (v, dir);
+        }
+        p = free;
+        return p - p0;
+      }
+
+      free = hi;
+      if (lead_first) kl += dir; else kt += dir;
+    }
+
+    // Nothing in the way between the last crossing and the end
+    if (at (to))
+    {
+      p = free;
+      return p - p0;
+    }
+    p = to;
+    return d;
+  }
+
+  // Moves `pos` by up to `d` diagonally. The box moves along the line, in
+  // pieces between the crossings of the line itself; when one axis gets
+  // stuck the other one keeps going, sliding along whatever is in the way,
+  // and the stuck one keeps trying to catch up in case it comes free.
+  template <class T, class Hit>
+  void move_xy (V2 <T> & pos, V2 <T> d, V2 <T> size, Hit hit)
+  {
+    using std::floor, std::ceil, std::abs;
+
+    const V2 <T> p0 = pos;
+
+    // The times (0 to 1) at which the line crosses a whole coordinate, for
+    // either edge on either axis. Each edge crosses them evenly spaced, so
+    // they come from four counters, taking whichever is due first: no
+    // limit on how many there are and nothing to sort.
+    struct Edge
+    {
+      T k, e, dp, dir; // next coordinate, where the edge starts, how far it goes, which way
+    };
+    Edge edges [4];
+    int m = 0;
+    for (int axis = 0; axis < 2; axis++)
+    {
+      const T p = axis ? p0.y : p0.x, s = axis ? size.y : size.x, dp = axis ? d.y : d.x;
+      if (dp == 0) continue;
+      const T dir = dp > 0 ? 1 : -1;
+      for (const T e : { p, p + s })
+        edges[m++] = { dir > 0 ? floor (e) + 1 : ceil (e) - 1, e, dp, dir };
+    }
+
+    // The next crossing, or 1 once there are none left before the end
+    const auto next_crossing = [&]
+    {
+      int first = -1;
+      T t = 1;
+      for (int j = 0; j < m; j++)
+      {
+        // Past the end of the move. Checked before dividing, which can
+        // overflow in fixed point when `dp` is tiny.
+        if (! (abs (edges[j].k - edges[j].e) < abs (edges[j].dp))) continue;
+
+        const T tj = (edges[j].k - edges[j].e) / edges[j].dp;
+        if (tj < t) { t = tj; first = j; }
+      }
+      if (first >= 0) edges[first].k += edges[first].dir;
+      return t;
+    };
+
+    for (bool last = false; ! last;)
+    {
+      const T t = next_crossing ();
+      last = ! (t < 1);
+      const T tx = ! last ? p0.x + d.x * t : p0.x + d.x;
+      const T ty = ! last ? p0.y + d.y * t : p0.y + d.y;
+
+      const T mx = move_axis (pos, 0, tx - pos.x, size, hit);
+      const T my = move_axis (pos, 1, ty - pos.y, size, hit);
+
+      if (mx == 0 && my == 0 && (pos.x != tx || pos.y != ty))
+        return; // stuck on both axes
+    }
+  }
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include "V2.h"
@@ -27,6 +30,18 @@ struct TileMap
 };
 
 
+// Some of the tiles of a room, relative to it, from `p0` to `p1` inclusive
+struct TileRange
+{
+  V2 <int> p0, p1;
+
+  bool empty () const
+  {
+    return p0.x > p1.x || p0.y > p1.y;
+  }
+};
+
+
 TileMap new_tile_map (int w, int h)
 {
   tile_t * tiles = reinterpret_cast<tile_t *>(calloc (w*h, 1));
@@ -41,7 +56,7 @@ TileMap new_tile_map (int w, int h)
 
 enum Trit { X, O, I };
 
-bool trit_bool (Trit a, bool b)
+constexpr bool trit_bool (Trit a, bool b)
 {
   switch (a)
   {
@@ -52,7 +67,7 @@ bool trit_bool (Trit a, bool b)
   }
 }
 
-bool match (const bool x [8], const Trit pat [8])
+constexpr bool match (const bool x [8], const Trit pat [8])
 {
   for (int i = 0; i < 8; i++)
   {
@@ -69,7 +84,7 @@ struct Rule
 };
 
 
-Rule <V2 <int>> rules [] =
+constexpr Rule <V2 <int>> rules [] =
   { Rule <V2 <int>> {
       { I, I, I
       , I,    I
@@ -208,7 +223,7 @@ Rule <V2 <int>> rules [] =
       , I, I, O }, V2 <int> {4, 14} }
   };
 
-std::optional<V2<int>> doRules (const bool x [8])
+constexpr std::optional<V2<int>> doRules (const bool x [8])
 {
   for (const auto rule : rules)
   {
@@ -217,6 +232,52 @@ std::optional<V2<int>> doRules (const bool x [8])
   return std::nullopt;
 }
 
+// `doRules` for every combination of neighbours, worked out at compile
+// time: bit `i` of the index is `x[i]`, and the entry is the tile as
+// `x << 4 | y`, or `no_tile` if no rule matches.
+constexpr uint8_t no_tile = 0xff;
+
+constexpr std::array<uint8_t, 256> auto_tile_lut = []
+{
+  std::array<uint8_t, 256> lut {};
+  for (int m = 0; m < 256; m++)
+  {
+    bool x [8];
+    for (int i = 0; i < 8; i++) x[i] = m >> i & 1;
+
+    const auto r = doRules (x);
+    lut[m] = r ? r->x << 4 | r->y : no_tile;
+  }
+  return lut;
+} ();
+
+constexpr std::optional<V2<int>> lookup_rules (int mask)
+{
+  const uint8_t t = auto_tile_lut[mask];
+  if (t == no_tile) return std::nullopt;
+  return V2<int> {t >> 4, t & 15};
+}
+
+// Every tile has to fit in a nibble each way, and come out of the table
+// the same as out of the rules
+static_assert ([]
+{
+  for (const auto & r : rules)
+    if (r.res.x < 0 || r.res.x > 15 || r.res.y < 0 || r.res.y > 15)
+      return false;
+
+  for (int m = 0; m < 256; m++)
+  {
+    bool x [8];
+    for (int i = 0; i < 8; i++) x[i] = m >> i & 1;
+
+    const auto a = doRules (x), b = lookup_rules (m);
+    if (a.has_value () != b.has_value ()) return false;
+    if (a && (a->x != b->x || a->y != b->y)) return false;
+  }
+  return true;
+} ());
+
 bool solid (TileMap tm, V2<int> pos)
 {
   if (pos.x < 0 || pos.x >= tm.size.x || pos.y < 0 || pos.y >= tm.size.y) return true;
@@ -239,15 +300,14 @@ std::optional<V2<int>> auto_tile (TileMap tm, V2<int> pos)
     , V2<int> {1,1}
     };
 
-  bool ns [8];
+  int mask = 0;
   for (int i = 0; i < 8; i++)
   {
     const auto off = pts[i];
-    ns[i] = solid (tm, V2 <int> {pos.x + off.x, pos.y + off.y});
+    mask |= solid (tm, V2 <int> {pos.x + off.x, pos.y + off.y}) << i;
   }
-  /*std::cout << ns[0] << ns[1] << ns[2] << '\n' << ns[3] << ' ' << ns[4] << '\n' << ns[5] << ns[6] << ns[7] << std::endl;*/
 
-  return doRules (ns);
+  return lookup_rules (mask);
 }
 
 // -----
@@ -259,75 +319,91 @@ std::optional<V2<int>> auto_tile (TileMap tm, V2<int> pos)
 // come in different "intensities", and we want to reduce the intensity
 // the further the tile is from air.
 //
+// How many variations the tileset has of tiles 1, 2, ... tiles away from
+// air, one intensity each. Tiles further away than that are all the plain
+// fill tile. More intensities only need more entries here.
+constexpr int flavor_variety [] = { 4, 10 };
+constexpr int flavor_reach = std::size (flavor_variety);
+constexpr int flavor_fill  = 14;
+static_assert (flavor_reach < 127);
+
+// The flavor of the tile at `x`, `y`, `d` tiles from the nearest air (0 if
+// it is air, anything past `flavor_reach` if it's further than that)
+char flavor_of (int d, int x, int y)
+{
+  if (d == 0) return 0;
+  if (d > flavor_reach) return flavor_fill;
+  return (x+y) % flavor_variety[d-1]; // "psuedo-random" selection.
+}
+
+// How far each tile is from air, counting steps up, down and sideways, in
+// two passes over the room: one from the top left that takes the distances
+// from above and from the left, one from the bottom right that takes them
+// from below and from the right. Tiles outside the room aren't air, and
+// distances stop counting past `flavor_reach`, so they fit in a `char`
+// however deep the intensities go.
 char * flavor (const TileMap & tm)
 {
-  const int size = tm.size.x * tm.size.y;
+  const int w = tm.size.x, h = tm.size.y;
+  constexpr char far = flavor_reach + 1;
 
-  char * buf = reinterpret_cast<char *>(malloc(size));
-  for (int i = 0; i < size; i++)
+  char * buf = reinterpret_cast<char *>(malloc(w * h));
+  const auto step = [&] (char a, char b)
   {
-    buf[i] = (tm.tiles[i] == 0) ? 0 : 14;
-  }
+    return std::min<char> (a, std::min<char> (b + 1, far));
+  };
 
-  char * tmp = reinterpret_cast<char *>(malloc(size));
-  for (int j = 0; j < 2; j++)
+  for (int y=0; y < h; y++)
   {
-    memcpy(tmp, buf, size);
-    for (int y=0; y < tm.size.y; y++)
+    for (int x=0; x < w; x++)
     {
-      for (int x=0; x < tm.size.x; x++)
-      {
-        const int i = y*tm.size.x+x;
-        const char a = buf[i];
-        if (! (a > 1)) continue;
-
-        const V2<int> offs [4] =
-          { V2<int> {0, -1}
-          , V2<int> {-1, 0}
-          , V2<int> {1,0}
-          , V2<int> {0,1}
-          };
-
-        int b = 14;
-        for (const auto & off : offs)
-        {
-          const auto & [ox, oy] = off.vals;
-          const int x2 = x+ox;
-          const int y2 = y+oy;
-          const int i2 = y2*tm.size.x+x2;
-          const int b2 =
-            (x2 < 0 || x2 >= tm.size.x || y2 < 0 || y2 >= tm.size.y)
-            ? 14
-            : tmp[i2];
-          if (b > b2) b = b2;
-        }
-        b++;
-
-        if (! (a > b)) continue;
-        buf[i] = b;
-      }
+      const int i = y*w+x;
+      char d = (tm.tiles[i] == 0) ? 0 : far;
+      if (y > 0) d = step (d, buf[i-w]);
+      if (x > 0) d = step (d, buf[i-1]);
+      buf[i] = d;
     }
   }
-  free(tmp);
-
-  for (int y=0; y < tm.size.y; y++)
+  for (int y=h; y-- > 0;)
   {
-    for (int x=0; x < tm.size.x; x++)
+    for (int x=w; x-- > 0;)
     {
-      const int i = y*tm.size.x+x;
-      const char a = buf[i];
-      switch (a)
-      {
-        case 1: buf[i] = (x+y) % 4; break;  // "psuedo-random" selection.
-        case 2: buf[i] = (x+y) % 10; break;
-        default: break;
-      }
+      const int i = y*w+x;
+      char d = buf[i];
+      if (y < h-1) d = step (d, buf[i+w]);
+      if (x < w-1) d = step (d, buf[i+1]);
+      buf[i] = d;
     }
   }
 
+  for (int y=0; y < h; y++)
+    for (int x=0; x < w; x++)
+      buf[y*w+x] = flavor_of (buf[y*w+x], x, y);
+
   return buf;
 }
 
+// The flavor `flavor` gives the tile at `pos`, from the tiles within
+// `flavor_reach` of it
+char flavor_at (const TileMap & tm, V2<int> pos)
+{
+  const auto air = [&] (int x, int y)
+  {
+    return x >= 0 && x < tm.size.x && y >= 0 && y < tm.size.y && tm.tiles[y*tm.size.x+x] == 0;
+  };
+
+  int d = flavor_reach + 1;
+  for (int dy = -flavor_reach; dy <= flavor_reach; dy++)
+    for (int dx = -flavor_reach; dx <= flavor_reach; dx++)
+    {
+      const int k = abs (dx) + abs (dy);
+      if (k < d && air (pos.x + dx, pos.y + dy))
+        d = k;
+    }
+
+  return flavor_of (d, pos.x, pos.y);
+}
+
 // ----
 
 struct TileInfo
@@ -350,62 +426,486 @@ struct TileInfo
   }
 };
 
+// Tile `t` as it's drawn: the tile `auto_tile` picked for it, `at`, with
+// flavor `fl` in place of whichever coordinate the tileset varies
+TileInfo tile_info (tile_t t, V2<int> at, char fl)
+{
+  return TileInfo
+    { .tileset = t
+    , .tx = (unsigned char) ((at.x != 0) ? at.x : fl)
+    , .ty = (unsigned char) ((at.x != 5) ? at.y : fl)
+    };
+}
+
+// For `auto_tile_room`: bit `i` of a byte, moved to the bottom of byte `i`
+// of a word
+constexpr std::array<uint64_t, 256> spread_bits = []
+{
+  std::array<uint64_t, 256> t {};
+  for (int b = 0; b < 256; b++)
+    for (int i = 0; i < 8; i++)
+      t[b] |= (uint64_t) (b >> i & 1) << (8*i);
+  return t;
+} ();
+
+// `auto_tile` for every tile of a room at once, with the flavors from `flv`
+// mixed in, into `out`.
+//
+// Instead of looking up each tile's eight neighbours one at a time, it keeps
+// the room as rows of bits, padded with solid all around like `solid` pads
+// it, and reads the neighbours of 64 tiles at a time out of the rows above,
+// at and below, shifted by one either way. The masks of eight tiles are put
+// together at once, a byte each, and only the solid ones get looked up in
+// `auto_tile_lut`.
+void auto_tile_room (const TileMap & tm, const char * flv, TileInfo * out)
+{
+  const int w = tm.size.x, h = tm.size.y;
+  const int pw = w + 2;
+  const int stride = (pw + 63) / 64 + 1; // one spare word, so `get` can read past the end
+
+  std::vector<uint64_t> bits ((size_t) (h + 2) * stride, 0);
+  const auto set = [&] (int py, int px)
+  {
+    bits[py*stride + px/64] |= uint64_t(1) << (px%64);
+  };
+  for (int px=0; px < pw; px++)
+  {
+    set (0, px);
+    set (h + 1, px);
+  }
+  for (int y=0; y < h; y++)
+  {
+    uint64_t * row = bits.data () + (y + 1)*stride;
+    const tile_t * src = tm.tiles + y*w;
+
+    // Eight tiles at a time: the top bit of every nonzero byte, gathered
+    // into the bottom byte
+    for (int x=0; x < w; x += 8)
+    {
+      uint64_t v = 0;
+      memcpy (&v, src + x, std::min (8, w - x));
+      const uint64_t nz = (((v & 0x7f7f7f7f7f7f7f7f) + 0x7f7f7f7f7f7f7f7f) | v) & 0x8080808080808080;
+      const uint64_t b8 = (nz >> 7) * 0x0102040810204080 >> 56;
+
+      const int px = x + 1;
+      row[px/64] |= b8 << (px%64);
+      if (px%64 > 56)
+        row[px/64 + 1] |= b8 >> (64 - px%64);
+    }
+    set (y + 1, 0);
+    set (y + 1, w + 1);
+  }
+
+  // 64 bits of padded row `py`, from column `px` on
+  const auto get = [&] (int py, int px)
+  {
+    const uint64_t * row = bits.data () + py*stride;
+    const int i = px / 64, sh = px % 64;
+    return sh ? row[i] >> sh | row[i + 1] << (64 - sh) : row[i];
+  };
+
+  memset (out, 0, sizeof (TileInfo) * w * h);
+
+  for (int y=0; y < h; y++)
+  {
+    for (int x0=0; x0 < w; x0 += 64)
+    {
+      // in the order of `auto_tile`'s `pts`
+      const uint64_t n [8] =
+        { get (y,     x0), get (y,     x0 + 1), get (y,     x0 + 2)
+        , get (y + 1, x0),                      get (y + 1, x0 + 2)
+        , get (y + 2, x0), get (y + 2, x0 + 1), get (y + 2, x0 + 2)
+        };
+
+      uint64_t c = get (y + 1, x0 + 1);
+      if (w - x0 < 64)
+        c &= (uint64_t(1) << (w - x0)) - 1;
+
+      // Eight tiles at a time: byte `k` of `masks` is tile `k`'s mask
+      for (int k0=0; k0 < 64; k0 += 8)
+      {
+        uint32_t cb = c >> k0 & 0xff;
+        if (! cb) continue;
+
+        uint64_t masks = 0;
+        for (int j=0; j < 8; j++)
+          masks |= spread_bits[n[j] >> k0 & 0xff] << j;
+
+        for (; cb; cb &= cb - 1)
+        {
+          const int k = __builtin_ctz (cb);
+          const uint8_t t = auto_tile_lut[masks >> (8*k) & 0xff];
+          if (t == no_tile) continue;
+
+          const int i = y*w + x0 + k0 + k;
+          out[i] = tile_info (tm.tiles[i], {t >> 4, t & 15}, flv[i]);
+        }
+      }
+    }
+  }
+}
+
+// ----
+
+// The base `TileMap` is the room as it was made, `tile_t`s like in the
+// level file, and what `set_tile` changes. Everything else is worked out
+// from it.
 struct TileMapEx : TileMap
 {
   V2 <int> pos, size;
   TileInfo * tiles;
 
+  // Which tiles are nonempty, one bit per tile, `stride` words per row.
+  // Collision checks only need this, and a whole room fits in a few cache
+  // lines where the `TileInfo`s take a few KB.
+  uint64_t * solid;
+  int stride;
+
+  // For every tile and direction, how many empty tiles there are from it
+  // (itself included) to the nearest nonempty one that way. Runs that
+  // reach the edge of the room, or are `open` long, are `open`, so they
+  // fit in a byte. One plane of `size.x * size.y` per direction.
+  enum Dir { Left, Right, Up, Down };
+  static constexpr int open = 255;
+  uint8_t * runs;
+
+  // Whether each block of 4x4 (level 0) or 16x16 (level 1) tiles is all
+  // empty, all solid or some of each, so that big boxes and rays can settle
+  // whole blocks at once instead of reading every tile. Blocks along the
+  // right and bottom edge stick out of the room, they only count the tiles
+  // in it.
+  enum Occupancy : uint8_t { Empty, Full, Mixed };
+  static constexpr int block_shift [2] = { 2, 4 };
+  V2 <int> block_dims [2];
+  uint8_t * blocks [2];
+
   TileMapEx (const TileMap & tm)
   {
     pos  = tm.pos;
     size = tm.size;
 
     const int sz = size.x * size.y;
+    raw () = { .pos = pos, .size = size, .tiles = reinterpret_cast<tile_t*>(malloc(sz)) };
+    memcpy (raw ().tiles, tm.tiles, sz);
+
     tiles = reinterpret_cast<TileInfo*>(malloc(sizeof(TileInfo) * sz));
 
     char * flv = flavor(tm);
+    auto_tile_room (tm, flv, tiles);
+    free (flv);
 
-    for (int y=0; y < tm.size.y; y++)
+    derive ();
+  }
+
+  // What `derive` works out, somewhere else, see below
+  struct Planes
+  {
+    uint64_t * solid;
+    uint8_t  * runs;
+    uint8_t  * blocks [2];
+  };
+
+  // Takes `tiles` that are already autotiled from `tm`, and `planes` that
+  // are already derived from those, as they come out of a binary level file
+  // (see level_file.h), and uses them all in place
+  TileMapEx (const TileMap & tm, TileInfo * tiles_, Planes planes)
+  {
+    pos   = tm.pos;
+    size  = tm.size;
+    tiles = tiles_;
+    raw () = tm;
+
+    stride = stride_of (size);
+    solid  = planes.solid;
+    runs   = planes.runs;
+    for (int l=0; l < 2; l++)
     {
-      for (int x=0; x < tm.size.x; x++)
-      {
-        const int i = y*tm.size.x+x;
-        const auto q = auto_tile (tm, {x, y});
-        if (! q.has_value ())
-        {
-          tiles[i].tileset = 0;
-          continue;
-        }
-        auto [tx, ty] = q.value().vals;
-        const auto fl = flv[i];
+      block_dims[l] = block_dims_of (l, size);
+      blocks[l]     = planes.blocks[l];
+    }
+  }
+
+  // How many words a row of `solid` takes, and how many blocks there are,
+  // in a room of `size`
+  static int stride_of (V2<int> size)
+  {
+    return (size.x + 63) / 64;
+  }
+  static V2<int> block_dims_of (int l, V2<int> size)
+  {
+    const int sh = block_shift[l];
+    return { (size.x + (1 << sh) - 1) >> sh, (size.y + (1 << sh) - 1) >> sh };
+  }
+
+  TileMap & raw () { return *this; }
+  const TileMap & raw () const { return *this; }
+
+  bool is_solid (V2<int> p) const
+  {
+    return (solid[p.y*stride + p.x/64] >> (p.x%64)) & 1;
+  }
 
-        tiles[i].tileset = tm.tiles[i];
-        tiles[i].tx = (tx != 0) ? tx : fl;
-        tiles[i].ty = (tx != 5) ? ty : fl;
+  // Whether any tile from x0, y0 to x1, y1 (inclusive, and inside the room)
+  // is nonempty. Tests a whole row of up to 64 tiles at once.
+  bool any_solid (int x0, int y0, int x1, int y1) const
+  {
+    // Boxes as tall as a block go by blocks, smaller ones are quicker to
+    // just read
+    if (y1 - y0 >= 1 << block_shift[1])
+      return any_solid_blocks (x0, y0, x1, y1);
+    return any_solid_rows (x0, y0, x1, y1);
+  }
+
+  bool any_solid_rows (int x0, int y0, int x1, int y1) const
+  {
+    const int w0 = x0 / 64, w1 = x1 / 64;
+    const uint64_t m0 = ~uint64_t(0) << (x0 % 64);
+    const uint64_t m1 = ~uint64_t(0) >> (63 - x1 % 64);
+
+    for (int y = y0; y <= y1; y++)
+    {
+      const uint64_t * row = solid + y*stride;
+      if (w0 == w1)
+      {
+        if (row[w0] & m0 & m1) return true;
+        continue;
       }
+      if (row[w0] & m0) return true;
+      for (int w = w0+1; w < w1; w++)
+        if (row[w]) return true;
+      if (row[w1] & m1) return true;
     }
+    return false;
+  }
 
-    free (flv);
+  // Whether every tile from x0, y0 to x1, y1 (inclusive, and inside the
+  // room) is nonempty
+  bool all_solid (int x0, int y0, int x1, int y1) const
+  {
+    for (int y = y0; y <= y1; y++)
+      for (int x = x0; x <= x1; x += 64)
+      {
+        const int k = std::min (x1 - x + 1, 64);
+        const uint64_t m = k == 64 ? ~uint64_t(0) : (uint64_t(1) << k) - 1;
+        if (~row_bits (x, y) & m) return false;
+      }
+    return true;
+  }
+
+  // The solid bits of row `y` from `x0` on, up to 64 of them; zero past
+  // the end of the row
+  uint64_t row_bits (int x0, int y) const
+  {
+    const uint64_t * row = solid + y*stride;
+    const int w = x0 / 64, sh = x0 % 64;
+    uint64_t v = row[w] >> sh;
+    if (sh && w + 1 < stride)
+      v |= row[w + 1] << (64 - sh);
+    return v;
+  }
+
+  Occupancy block (int l, V2<int> b) const
+  {
+    return (Occupancy) blocks[l][b.y * block_dims[l].x + b.x];
+  }
+  // The level `l` block that tile `p` is in
+  Occupancy block_at (int l, V2<int> p) const
+  {
+    return block (l, { p.x >> block_shift[l], p.y >> block_shift[l] });
+  }
+
+  int run (V2<int> p, Dir d) const
+  {
+    return runs [d * size.x * size.y + p.x + p.y * size.x];
+  }
+
+  // Makes the tile at `p` solid or not as far as collisions are concerned,
+  // and updates the runs that go through it: the rest of its row and
+  // column, no more.
+  void set_solid (V2<int> p, bool s)
+  {
+    const uint64_t bit = uint64_t(1) << (p.x%64);
+    uint64_t & w = solid[p.y*stride + p.x/64];
+    w = s ? (w | bit) : (w & ~bit);
+
+    runs_row (p.y);
+    runs_col (p.x);
+    blocks_update (p);
+  }
+
+  // Changes the tile at `p` to `t`, 0 for empty or 1 + a tileset, and
+  // redoes only what that can change: the autotiling of the tiles next to
+  // it, the flavor of the ones within `flavor_reach` of it, and collisions
+  // for the ones that turned empty or solid. Returns the tiles whose
+  // `TileInfo` changed, for whatever has to redraw them.
+  TileRange set_tile (V2<int> p, tile_t t)
+  {
+    TileRange dirty { { size.x, size.y }, { -1, -1 } };
+    if (raw ()[p] == t) return dirty;
+    raw ()[p] = t;
+
+    const int r = std::max (1, flavor_reach);
+    for (int y = std::max (p.y - r, 0); y <= std::min (p.y + r, size.y - 1); y++)
+      for (int x = std::max (p.x - r, 0); x <= std::min (p.x + r, size.x - 1); x++)
+      {
+        const V2<int> q { x, y };
+        const auto at = auto_tile (raw (), q);
+        const TileInfo n = at ? tile_info (raw ()[q], *at, flavor_at (raw (), q)) : TileInfo {};
+
+        TileInfo & o = (*this)[q];
+        if (o.tileset == n.tileset && o.tx == n.tx && o.ty == n.ty) continue;
+
+        const bool was = o.is_nonempty ();
+        o = n;
+        if (was != n.is_nonempty ())
+          set_solid (q, ! was);
+
+        dirty.p0 = { std::min (dirty.p0.x, x), std::min (dirty.p0.y, y) };
+        dirty.p1 = { std::max (dirty.p1.x, x), std::max (dirty.p1.y, y) };
+      }
+    return dirty;
   }
 
   TileInfo & operator [] (V2<int> pos)
   {
     return tiles [pos.x + pos.y * size.x];
   }
+  const TileInfo & operator [] (V2<int> pos) const
+  {
+    return tiles [pos.x + pos.y * size.x];
+  }
+
+private:
+  // Works out everything collision needs from `tiles`: `solid`, the runs
+  // and the blocks
+  void derive ()
+  {
+    const int sz = size.x * size.y;
+
+    stride = stride_of (size);
+    solid = reinterpret_cast<uint64_t*>(calloc(stride * size.y, sizeof(uint64_t)));
+    for (int y=0; y < size.y; y++)
+      for (int x=0; x < size.x; x++)
+        if (tiles[y*size.x+x].is_nonempty())
+          solid[y*stride + x/64] |= uint64_t(1) << (x%64);
+
+    runs = reinterpret_cast<uint8_t*>(malloc(4 * sz));
+    for (int y=0; y < size.y; y++) runs_row (y);
+    for (int x=0; x < size.x; x++) runs_col (x);
+
+    for (int l=0; l < 2; l++)
+    {
+      block_dims[l] = block_dims_of (l, size);
+      blocks[l] = reinterpret_cast<uint8_t*>(malloc(block_dims[l].x * block_dims[l].y));
+    }
+    // All of level 0 first, level 1 is made of it
+    for (int l=0; l < 2; l++)
+      for (int y=0; y < block_dims[l].y; y++)
+        for (int x=0; x < block_dims[l].x; x++)
+          block_update (l, {x, y});
+  }
+
+  // `any_solid`, skipping the level 1 blocks that are empty and stopping
+  // at the first one that's full. Only mixed ones get read.
+  bool any_solid_blocks (int x0, int y0, int x1, int y1) const
+  {
+    const int sh = block_shift[1];
+    for (int by = y0 >> sh; by <= y1 >> sh; by++)
+      for (int bx = x0 >> sh; bx <= x1 >> sh; bx++)
+      {
+        const Occupancy o = block (1, {bx, by});
+        if (o == Empty) continue;
+        if (o == Full) return true;
+
+        const int cx0 = std::max (x0, bx << sh), cx1 = std::min (x1, ((bx + 1) << sh) - 1);
+        const int cy0 = std::max (y0, by << sh), cy1 = std::min (y1, ((by + 1) << sh) - 1);
+        if (any_solid_rows (cx0, cy0, cx1, cy1)) return true;
+      }
+    return false;
+  }
+
+  // Works out the level 0 block tile `p` is in from its tiles, and the
+  // level 1 block around that from its level 0 blocks
+  void blocks_update (V2<int> p)
+  {
+    for (int l=0; l < 2; l++)
+      block_update (l, { p.x >> block_shift[l], p.y >> block_shift[l] });
+  }
+
+  // Works out level `l` block `b` from what it's made of: tiles for level
+  // 0, level 0 blocks for level 1
+  void block_update (int l, V2<int> b)
+  {
+    const int sub = l ? block_shift[1] - block_shift[0] : block_shift[0];
+    const V2<int> lo { b.x << sub, b.y << sub };
+    const V2<int> hi
+      { std::min ((b.x + 1) << sub, l ? block_dims[0].x : size.x)
+      , std::min ((b.y + 1) << sub, l ? block_dims[0].y : size.y)
+      };
+
+    bool any_empty = false, any_full = false;
+    for (int y = lo.y; y < hi.y; y++)
+      for (int x = lo.x; x < hi.x; x++)
+      {
+        const Occupancy o = l ? block (0, {x, y}) : is_solid ({x, y}) ? Full : Empty;
+        any_empty |= o != Full;
+        any_full  |= o != Empty;
+      }
+
+    blocks[l][b.y * block_dims[l].x + b.x] = any_empty && any_full ? Mixed : any_full ? Full : Empty;
+  }
+
+  // Fills in the runs along row `y` (left and right) or column `x` (up and
+  // down), one pass each way
+  void runs_row (int y)
+  {
+    const int n = size.x * size.y;
+    uint8_t * l = runs + Left  * n + y * size.x;
+    uint8_t * r = runs + Right * n + y * size.x;
+
+    int k = open;
+    for (int x = 0; x < size.x; x++)
+      l[x] = k = is_solid ({x, y}) ? 0 : std::min (k + 1, open);
+    k = open;
+    for (int x = size.x; x-- > 0;)
+      r[x] = k = is_solid ({x, y}) ? 0 : std::min (k + 1, open);
+  }
+
+  void runs_col (int x)
+  {
+    const int n = size.x * size.y;
+    uint8_t * u = runs + Up   * n + x;
+    uint8_t * d = runs + Down * n + x;
+
+    int k = open;
+    for (int y = 0; y < size.y; y++)
+      u[y * size.x] = k = is_solid ({x, y}) ? 0 : std::min (k + 1, open);
+    k = open;
+    for (int y = size.y; y-- > 0;)
+      d[y * size.x] = k = is_solid ({x, y}) ? 0 : std::min (k + 1, open);
+  }
 };
 
 // ----
 
 
+// The text level format: for every room `x;y;w;h;` followed by its `w * h`
+// tiles, one byte each, row by row. Rooms follow each other until the end of
+// the file. Binary levels (see level_file.h) are much quicker to open.
+
 int pop_int (FILE * s)
 {
   int n = 0;
   int sign = 1;
   for (;;)
   {
-    const char c = fgetc(s);
+    const int c = fgetc(s);
     if (c == ';') break;
     if (c == '-') { sign *= -1; continue; }
+    if (c == EOF)
+      throw std::runtime_error ("Level file ends in the middle of a room");
+    if (c < '0' || c > '9')
+      throw std::runtime_error ("Bad number in level file");
     n = n * 10 + c - '0';
   }
   return n * sign;
@@ -423,12 +923,16 @@ TileMap pop_tilemap (FILE * s)
 {
   auto pos  = pop_int2 (s);
   auto size = pop_int2 (s);
+  if (size.x <= 0 || size.y <= 0)
+    throw std::runtime_error ("Bad room size in level file");
 
-  // I don't know why I need the +1, is C 0-terminating? What the crap!
-  // I ask for N, but it gives me N-1 and a 0..?
-  const int sz = size.x * size.y + 1;
+  const size_t sz = (size_t) size.x * size.y;
   void * tiles = malloc (sz);
-  fgets(reinterpret_cast<char *>(tiles), sz, s);
+  if (fread (tiles, 1, sz, s) != sz)
+  {
+    free (tiles);
+    throw std::runtime_error ("Level file ends in the middle of a room");
+  }
   return TileMap
     { .pos   = pos
     , .size  = size
@@ -444,20 +948,36 @@ TileMapEx pop_tilemap_ex (FILE * s)
   return tmx;
 }
 
-std::vector<TileMapEx> load_tilemaps (const char * pth)
+std::vector<TileMapEx> load_tilemaps (FILE * f)
 {
-  FILE * f = fopen (pth, "r");
   std::vector<TileMapEx> v {};
-  for (int i=0; i < 20; i++)
-  /*while (! feof(f))*/
+  for (int c; (c = fgetc(f)) != EOF;)
   {
+    ungetc (c, f);
     v.push_back (pop_tilemap_ex (f));
-    /*fgetc(f);*/
   }
-  fclose(f);
   return v;
 }
 
+std::vector<TileMapEx> load_tilemaps (const char * pth)
+{
+  FILE * f = fopen (pth, "rb");
+  if (! f)
+    throw std::runtime_error ("Failed to open level");
+
+  try
+  {
+    auto v = load_tilemaps (f);
+    fclose (f);
+    return v;
+  }
+  catch (...)
+  {
+    fclose (f);
+    throw;
+  }
+}
+
 TileMapEx boring_screen (V2<int> pos, V2<int> size)
 {
   tile_t * buf = reinterpret_cast<tile_t *>(calloc(size.w*size.h, 1));
@@ -485,5 +1005,6 @@ TileMapEx boring_screen (V2<int> pos, V2<int> size)
 
   const TileMap tm {.pos=pos, .size=size, .tiles=buf};
   TileMapEx tmx (tm);
+  free (buf);
   return tmx;
 }
@@ -0,0 +1,531 @@
+#pragma once
+
+#include "V2.h"
+#include "tilemap.h"
+#include "room_index.h"
+#include "level_file.h"
+#include "player.h"
+#include "input.h"
+#include "entity.h"
+#include "broadphase.h"
+#include "hash.h"
+#include <fmt/core.h>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+// Everything the game needs to advance one tick, minus the window and
+// the renderer. This is shared by main.cpp and the headless sim.cpp.
+//
+// The level data (`Level`) only changes through `set_tile` and can be
+// shared by any number of worlds, even on different threads as long as
+// nobody calls that. Everything else that changes while playing lives in a
+// `World`, so independent worlds never touch each other.
+
+// ----------
+
+struct Level
+{
+  std::vector<TileMapEx> tilemaps;
+
+  // Rebuild with `rooms.build (tilemaps)` after changing `tilemaps`
+  RoomIndex rooms {};
+
+  // For binary levels, the file the tiles are in
+  LevelFile file {};
+
+  // Goes up every time `set_tile` changes something, so that anything that
+  // keeps what it read from the tiles knows to read them again
+  uint64_t revision = 0;
+
+  // Called by `set_tile` with the room and the tiles in it that changed
+  std::function <void (int room, TileRange dirty)> tiles_changed {};
+};
+
+// Changes the tile at `pos` in room `room` (relative to the room) to
+// `tileset`, 0 for empty or 1 + the tileset, and redoes the autotiling
+// around it, see `TileMapEx::set_tile`. For crumbling blocks and editing
+// levels while playing.
+void set_tile (Level & level, int room, V2 <int> pos, tile_t tileset)
+{
+  if (room < 0 || room >= (int) level.tilemaps.size ())
+    throw std::runtime_error ("No such room");
+  auto & tm = level.tilemaps[room];
+  if (pos.x < 0 || pos.x >= tm.size.x || pos.y < 0 || pos.y >= tm.size.y)
+    throw std::runtime_error ("Tile is outside the room");
+
+  const TileRange dirty = tm.set_tile (pos, tileset);
+  if (dirty.empty ()) return;
+
+  level.rooms.update (level.tilemaps, tm.pos + dirty.p0, tm.pos + dirty.p1);
+  level.revision++;
+  if (level.tiles_changed)
+    level.tiles_changed (room, dirty);
+}
+
+// Loads a text or binary level (see level_file.h), whichever `pth` is
+Level load_level (const char * pth)
+{
+  Level level {};
+  if (LevelFile::is_binary (pth))
+  {
+    level.file.open (pth);
+    for (uint32_t i = 0; i < level.file.rooms; i++)
+      level.tilemaps.push_back (level.file.tilemap (i));
+  }
+  else
+    level.tilemaps = load_tilemaps (pth);
+
+  level.tilemaps.push_back(boring_screen ({100, 100}, {700, 140}));
+  level.rooms.build (level.tilemaps);
+  return level;
+}
+
+// ----------
+
+template <class T>
+bool pt_in_rect (V2 <T> p1, V2 <T> p2, V2 <T> size)
+{
+  if (p1.x < p2.x || p1.y < p2.y) return false;
+  const V2 <T> p3 { p2.x+size.x, p2.y+size.y };
+  if (p1.x >= p3.x || p1.y >= p3.y) return false;
+  return true;
+}
+
+template <class T>
+bool rect_in_rect (V2 <T> p1, V2 <T> s1, V2 <T> p2, V2 <T> s2)
+{
+  return std::max(p1.x, p2.x) < std::min(p1.x + s1.x, p2.x + s2.x)
+      && std::max(p1.y, p2.y) < std::min(p1.y + s1.y, p2.y + s2.y);
+}
+
+// The first room that contains `pos`, or -1
+int room_at (const Level & level, V2 <int> pos)
+{
+  int room = -1;
+  level.rooms.any (pos, [&] (int i)
+  {
+    const auto & tm = level.tilemaps[i];
+    if (! pt_in_rect <int> (pos, tm.pos, tm.size))
+      return false;
+    room = i;
+    return true;
+  });
+  return room;
+}
+
+bool hit_test_int (const Level & level, V2 <int> pos)
+{
+  const int i = room_at (level, pos);
+  if (i < 0)
+    return false;
+
+  const auto & tm = level.tilemaps[i];
+  return tm.is_solid ({ pos.x - tm.pos.x, pos.y - tm.pos.y });
+}
+
+bool hit_test (const Level & level, V2 <coord> pos)
+{
+  return hit_test_int (level, {first_tile (pos.x), first_tile (pos.y)});
+}
+
+bool hit_test (const Level & level, V2 <coord> p1, V2 <coord> s1)
+{
+  const V2 <int> c0 { tile_floor (p1.x),        tile_floor (p1.y)        };
+  const V2 <int> c1 { tile_floor (p1.x + s1.x), tile_floor (p1.y + s1.y) };
+
+  // Boxes as big as a block might be all in empty cells. A tile further
+  // out on every side covers what `tile_range` rounds to.
+  if ( (c1.x - c0.x >= 1 << TileMapEx::block_shift[1] || c1.y - c0.y >= 1 << TileMapEx::block_shift[1])
+    && level.rooms.empty ({ c0.x - 1, c0.y - 1 }, { c1.x + 1, c1.y + 1 }) )
+    return false;
+
+  return level.rooms.any (c0, c1, [&] (int i)
+  {
+    const auto & tm = level.tilemaps[i];
+    const V2 <coord> p2 { (coord) tm.pos.x,  (coord) tm.pos.y  };
+    const V2 <coord> s2 { (coord) tm.size.x, (coord) tm.size.y };
+    if (rect_in_rect (p1,s1,p2,s2))
+    {
+      const TileRange r = tile_range (tm, p1, s1);
+      if (! r.empty () && tm.any_solid (r.p0.x, r.p0.y, r.p1.x, r.p1.y))
+        return true;
+    }
+    return false;
+  });
+}
+
+// `hit_test` for up to 32 boxes at once: bit `i` is set if `rects[i]` hits
+// something. Meant for boxes close to each other, like the ones the player
+// checks around itself, so the rooms are only looked up once for all of
+// them, and each room's tiles under all of them are read into a small
+// window once rather than for every box.
+uint32_t hit_tests (const Level & level, const Rect * rects, int n)
+{
+  assert (n <= 32); // one bit each
+  if (n <= 0) return 0;
+
+  V2 <coord> q0 = rects[0].pos, q1 = q0;
+  for (int j = 0; j < n; j++)
+  {
+    const auto & [p, s] = rects[j];
+    q0 = { std::min (q0.x, p.x),       std::min (q0.y, p.y)       };
+    q1 = { std::max (q1.x, p.x + s.x), std::max (q1.y, p.y + s.y) };
+  }
+  const V2 <int> c0 { tile_floor (q0.x), tile_floor (q0.y) };
+  const V2 <int> c1 { tile_floor (q1.x), tile_floor (q1.y) };
+
+  const uint32_t all = n == 32 ? ~0u : (1u << n) - 1;
+  uint32_t hits = 0;
+
+  level.rooms.any (c0, c1, [&] (int i)
+  {
+    const auto & tm = level.tilemaps[i];
+    const V2 <coord> p2 { (coord) tm.pos.x,  (coord) tm.pos.y  };
+    const V2 <coord> s2 { (coord) tm.size.x, (coord) tm.size.y };
+
+    // The boxes that still need looking at in this room, and the tiles
+    // under all of them
+    TileRange rs [32];
+    uint32_t todo = 0;
+    TileRange win { { tm.size.x, tm.size.y }, { -1, -1 } };
+    for (int j = 0; j < n; j++)
+    {
+      if (hits >> j & 1 || ! rect_in_rect (rects[j].pos, rects[j].size, p2, s2))
+        continue;
+      rs[j] = tile_range (tm, rects[j].pos, rects[j].size);
+      if (rs[j].empty ())
+        continue;
+      todo |= 1u << j;
+      win.p0 = { std::min (win.p0.x, rs[j].p0.x), std::min (win.p0.y, rs[j].p0.y) };
+      win.p1 = { std::max (win.p1.x, rs[j].p1.x), std::max (win.p1.y, rs[j].p1.y) };
+    }
+    if (! todo)
+      return false;
+
+    constexpr int max_rows = 16;
+    if (win.p1.x - win.p0.x >= 64 || win.p1.y - win.p0.y >= max_rows)
+    {
+      for (int j = 0; j < n; j++)
+        if (todo >> j & 1 && tm.any_solid (rs[j].p0.x, rs[j].p0.y, rs[j].p1.x, rs[j].p1.y))
+          hits |= 1u << j;
+      return hits == all;
+    }
+
+    uint64_t rows [max_rows];
+    for (int y = win.p0.y; y <= win.p1.y; y++)
+      rows[y - win.p0.y] = tm.row_bits (win.p0.x, y);
+
+    for (int j = 0; j < n; j++)
+    {
+      if (! (todo >> j & 1)) continue;
+      const int a = rs[j].p0.x - win.p0.x, b = rs[j].p1.x - win.p0.x;
+      const uint64_t m = (~uint64_t(0) << a) & (~uint64_t(0) >> (63 - b));
+      for (int y = rs[j].p0.y; y <= rs[j].p1.y; y++)
+        if (rows[y - win.p0.y] & m)
+        {
+          hits |= 1u << j;
+          break;
+        }
+    }
+    return hits == all;
+  });
+  return hits;
+}
+
+// ----
+
+void Clearance::update (const Level & lvl, V2 <coord> pos, V2 <coord> size)
+{
+  const V2 <int> c0 { first_tile (pos.x),         first_tile (pos.y)         };
+  const V2 <int> c1 { last_tile  (pos.x, size.x), last_tile  (pos.y, size.y) };
+  if ( level == &lvl && revision == lvl.revision
+    && c0.x == k0.x && c0.y == k0.y
+    && c1.x == k1.x && c1.y == k1.y
+     ) return;
+
+  level = &lvl;
+  revision = lvl.revision;
+  k0 = c0;
+  k1 = c1;
+  tm = nullptr;
+
+  // Other rooms could have a say in checks near the edges of this one, and
+  // a box that is partly outside is not worth the trouble
+  const int i = room_at (lvl, c0);
+  if (i < 0 || ! lvl.rooms.alone[i])
+    return;
+  const auto & t = lvl.tilemaps[i];
+  if (! pt_in_rect <int> (c1, t.pos, t.size))
+    return;
+
+  box = tile_range (t, pos, size);
+  if (box.empty () || t.any_solid (box.p0.x, box.p0.y, box.p1.x, box.p1.y))
+    return;
+
+  left = right = up = down = TileMapEx::open;
+  for (int y = box.p0.y; y <= box.p1.y; y++)
+  {
+    left  = std::min (left,  t.run ({box.p0.x, y}, TileMapEx::Left));
+    right = std::min (right, t.run ({box.p1.x, y}, TileMapEx::Right));
+  }
+  for (int x = box.p0.x; x <= box.p1.x; x++)
+  {
+    up   = std::min (up,   t.run ({x, box.p0.y}, TileMapEx::Up));
+    down = std::min (down, t.run ({x, box.p1.y}, TileMapEx::Down));
+  }
+  tm = &t;
+}
+
+int Clearance::hit (V2 <coord> p, V2 <coord> s) const
+{
+  if (! tm)
+    return -1;
+
+  // `hit_test` would only look at this room if the box is inside it
+  const V2 <coord> r0 { (coord) tm->pos.x, (coord) tm->pos.y };
+  const V2 <coord> r1 { (coord) (tm->pos.x + tm->size.x), (coord) (tm->pos.y + tm->size.y) };
+  const V2 <coord> q { p.x + s.x, p.y + s.y };
+  if (! (r0.x <= p.x && p.x < q.x && q.x <= r1.x && r0.y <= p.y && p.y < q.y && q.y <= r1.y))
+    return -1;
+
+  const TileRange r = tile_range (*tm, p, s);
+  if (r.p0.y == box.p0.y && r.p1.y == box.p1.y)
+    return along (r.p0.x, r.p1.x, box.p0.x, box.p1.x, left, right);
+  if (r.p0.x == box.p0.x && r.p1.x == box.p1.x)
+    return along (r.p0.y, r.p1.y, box.p0.y, box.p1.y, up, down);
+  return -1;
+}
+
+
+// ----
+
+// x, y is the negated top left corner of the view, z is the zoom
+struct Camera
+{
+  float x = 0, y = 0, z = 0;
+};
+
+struct World
+{
+  const Level * level;
+
+  Clock clock {};
+  KeyMap keymap {};
+
+  // int current_screen = 0;
+  // Player player
+  //   {V2<float>{ 3, 16 }
+  //   };
+
+  // int current_screen = 12;
+  // Player player
+  //   {V2<float>{ 82+10, -174 + 17 }
+  //   };
+
+  int current_screen = 6;
+  Player player
+    {V2<coord>{ 162+8, -151 + 16 }
+    };
+
+  Camera cam {};
+  Particles particles {};
+  std::vector<Entity *> entities {};
+
+  // Running hash of everything above, updated at the end of every tick
+  StateHash state_hash {};
+
+  // How much collision checking the player has done. Not part of the
+  // state, just for seeing where the time goes.
+  struct CollisionCost
+  {
+    uint64_t queries = 0; // calls to `Player::hit_tests`
+    uint64_t boxes   = 0; // boxes those asked about
+    uint64_t slow    = 0; // boxes `Clearance` couldn't answer
+    uint64_t lookups = 0; // calls to `hit_tests` for those
+
+    uint64_t split       = 0; // ticks `apply_velocity` cut into substeps
+    uint64_t substeps    = 0; // how many substeps those took
+    uint64_t over_budget = 0; // ticks that would have needed more than `max_substeps`
+  }
+  collisions {};
+
+  // Who touches whom this tick, see `find_overlaps`. Worked out again every
+  // tick, the only thing kept is the order it sorted things in last time.
+  Broadphase overlaps {};
+
+  // Whether to print what the player is doing ("super", "wall bounce", ...).
+  // Turn this off when running many worlds at once.
+  bool verbose = true;
+
+  World (const Level & level) : level { &level }
+  {
+  }
+
+  const std::vector<TileMapEx> & tilemaps () const
+  {
+    return level->tilemaps;
+  }
+
+  int get_current_screen () const
+  {
+    const V2 <coord> p1 { player.pos.x + player.size.x/2, player.pos.y + player.size.y/2};
+    const V2 <int> c { tile_floor (p1.x), tile_floor (p1.y) };
+
+    int screen = -1;
+    level->rooms.any (c, [&] (int i)
+    {
+      const auto & tm = tilemaps ()[i];
+      const V2 <coord> p2 { (coord) tm.pos.x,  (coord) tm.pos.y  };
+      const V2 <coord> s2 { (coord) tm.size.x, (coord) tm.size.y };
+      if (! pt_in_rect (p1,p2,s2))
+        return false;
+      screen = i;
+      return true;
+    });
+    return screen;
+  }
+
+  // Everything that happens when a key event arrives, whether it came from
+  // GLFW, a script or a recording.
+  void on_key (int key, int scancode, int action, int mods)
+  {
+    keymap.put (clock.ticks_elapsed, key,scancode,action,mods);
+
+    {
+      Key key = 'N';
+      if (key.fresh (keymap, clock, 1))
+      {
+        player.pos = V2 <coord> { 100 + 5, 100 + 3 };
+      }
+    }
+  }
+
+  // Advances the simulation by one tick. The caller is responsible for
+  // advancing the clock and skipping frozen ticks, see `step`.
+  void tick ()
+  {
+    particles.tick (clock);
+
+    for (auto e : entities)
+    {
+      e->tick (*this);
+    }
+
+    player.tick (*this);
+    find_overlaps ();
+
+    const int new_screen = get_current_screen ();
+
+    if (new_screen >= 0 && current_screen != new_screen)
+    {
+      current_screen = new_screen;
+      const auto & tm = tilemaps()[current_screen];
+      if (verbose)
+        fmt::print("new screen: {}, {}, {}\n", current_screen, tm.pos.x, tm.pos.y);
+
+      particles.ps.clear ();
+      clock.freeze_time (20); // sleep a bit after changing screens
+      player.n_dashes = 1;
+    }
+
+    state_hash.add (clock.ticks_elapsed, clock.frames_elapsed, current_screen, particles.rng.state);
+    player.hash (state_hash);
+  }
+
+  // Tells every entity what it overlaps now that everything has moved. The
+  // player's box goes in last, as id `entities.size ()`.
+  void find_overlaps ()
+  {
+    if (entities.empty ()) return;
+
+    overlaps.clear ();
+    for (const Entity * e : entities)
+      overlaps.add (e->pos, e->size);
+    overlaps.add (player.pos, player.size);
+    overlaps.find ();
+
+    const uint32_t player_id = entities.size ();
+    for (const auto [a, b] : overlaps.pairs)
+    {
+      if (b == player_id)
+        entities[a]->touch_player (*this);
+      else
+      {
+        entities[a]->overlap (*this, *entities[b]);
+        entities[b]->overlap (*this, *entities[a]);
+      }
+    }
+  }
+
+  // Advances the clock by one tick and runs it, unless we are frozen
+  void step ()
+  {
+    clock.step ();
+
+    if (! clock.is_frozen)
+      tick ();
+  }
+};
+
+// ----
+
+Clock        & Player::clock     () { return w->clock;     }
+const KeyMap & Player::keys      () { return w->keymap;    }
+Particles    & Player::particles () { return w->particles; }
+bool           Player::verbose   () { return w->verbose;   }
+
+uint32_t Player::hit_tests (std::initializer_list <Rect> rects)
+{
+  assert (rects.size () <= 32); // one bit each, like `::hit_tests`
+
+  auto & cost = w->collisions;
+  cost.queries++;
+  cost.boxes += rects.size ();
+
+  around.update (*w->level, pos, size);
+
+  // Whatever `around` can't tell goes to `hit_tests`, all together
+  Rect rest [32];
+  int  idx  [32];
+  int n = 0, i = 0;
+  uint32_t hits = 0;
+  for (const Rect & r : rects)
+  {
+    const int h = around.hit (r.pos, r.size);
+    if (h > 0)
+      hits |= 1u << i;
+    if (h < 0)
+    {
+      rest[n] = r;
+      idx[n++] = i;
+    }
+    i++;
+  }
+
+  if (n)
+  {
+    cost.slow += n;
+    cost.lookups++;
+    const uint32_t h = ::hit_tests (*w->level, rest, n);
+    for (int k = 0; k < n; k++)
+      if (h >> k & 1)
+        hits |= 1u << idx[k];
+  }
+  return hits;
+}
+
+void Player::count_substeps (int n, bool over_budget)
+{
+  auto & cost = w->collisions;
+  cost.split++;
+  cost.substeps += n;
+  cost.over_budget += over_budget;
+}
+
+bool Player::hit_test (V2 <coord> p, V2 <coord> s)
+{
+  return hit_tests ({ { p, s } });
+}